@@ -1,34 +1,251 @@
 #include <WiFi.h>
+#include <Preferences.h>
 #include <WebServer.h>
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include <time.h>
+#include <esp_timer.h>
+#include <atomic>
+#include <LittleFS.h>
+#include <soc/gpio_reg.h>
+#if EMS_METERING
+#include <esp_adc/adc_continuous.h>
+#endif
+#if EMS_MQTT
+#include <PubSubClient.h>
+#endif
+#if EMS_FLEET
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <esp_idf_version.h>
+#endif
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <type_traits>
+#include "dashboard_gz.h"
+#include "tiny_model.h"
+
+// ===== Build Options =====
+// EMS_DUAL_CORE=1 pins the control loop to its own task on core 1 and runs
+// WiFi, HTTP and the web server in a networking task on core 0.
+#ifndef EMS_DUAL_CORE
+#define EMS_DUAL_CORE 1
+#endif
+
+// EMS_SYNC_ENDPOINT=1 pushes status and pulls the next prediction with a
+// single POST to /api/sync instead of separate GET and POST calls.
+#ifndef EMS_SYNC_ENDPOINT
+#define EMS_SYNC_ENDPOINT 1
+#endif
+
+// EMS_TELEMETRY_BINARY=1 sends the uplink status as a 20-byte packed
+// TelemetryRecord instead of JSON. The server decodes both formats.
+#ifndef EMS_TELEMETRY_BINARY
+#define EMS_TELEMETRY_BINARY 0
+#endif
+
+// EMS_OFFLINE_LOG=1 keeps status records in a LittleFS log while the uplink
+// is down and replays them in bulk once it is back.
+#ifndef EMS_OFFLINE_LOG
+#define EMS_OFFLINE_LOG 1
+#endif
+
+// EMS_FIXED_POINT=1 runs the energy balance in integer units (mW, uJ)
+// with precomputed reciprocals: bit-exact on the device and on a host.
+#ifndef EMS_FIXED_POINT
+#define EMS_FIXED_POINT 0
+#endif
+
+// EMS_METERING=1 measures PV and load power with CT/voltage sensors on
+// ADC1 instead of using predictions and nameplate loads.
+#ifndef EMS_METERING
+#define EMS_METERING 0
+#endif
+
+// EMS_LOOKAHEAD=1 fetches the 24 h forecast and follows a dispatch plan
+// solved in the background; 0 keeps the purely reactive controller.
+#ifndef EMS_LOOKAHEAD
+#define EMS_LOOKAHEAD 1
+#endif
+
+// EMS_PREDICTION_CACHE=1 interpolates PV and consumption for every control
+// tick between the last prediction and the next forecast hours, so the
+// prediction only needs refreshing every 10 minutes.
+#ifndef EMS_PREDICTION_CACHE
+#define EMS_PREDICTION_CACHE 1
+#endif
+
+// EMS_TINY_MODEL=1 replaces the clear-sky guess used on stale predictions
+// with the small PV/load model from tiny_model.h (export_tiny_model.py).
+#ifndef EMS_TINY_MODEL
+#define EMS_TINY_MODEL 1
+#endif
+
+// EMS_MQTT=1 adds an MQTT uplink (PubSubClient): retained state, batched
+// samples and pushed predictions. HTTP stays as the fallback.
+#ifndef EMS_MQTT
+#define EMS_MQTT 0
+#endif
+
+// EMS_FAST_PATH=1 sheds loads from GPIO interrupts on grid loss and
+// overcurrent. Needs the sense inputs wired; floating inputs would trip.
+#ifndef EMS_FAST_PATH
+#define EMS_FAST_PATH 0
+#endif
+
+// EMS_WATCHDOG=1 opens the sheddable relays if the control loop stops
+// ticking, and restarts the chip if it does not come back.
+#ifndef EMS_WATCHDOG
+#define EMS_WATCHDOG 1
+#endif
+
+// EMS_FLEET=1 coordinates several units sharing one PV array and battery
+// over ESP-NOW: one elected coordinator runs the battery decision and sends
+// every node a power budget.
+#ifndef EMS_FLEET
+#define EMS_FLEET 0
+#endif
+
+// EMS_METRICS=1 serves counters and latency histograms in the Prometheus
+// text format at /metrics. Recording is a few relaxed atomic adds.
+#ifndef EMS_METRICS
+#define EMS_METRICS 1
+#endif
+
+// EMS_LOG_LEVEL: 0 off, 1 errors, 2 warnings, 3 info, 4 debug (the
+// per-tick energy trace). Messages above the level compile to nothing.
+#ifndef EMS_LOG_LEVEL
+#define EMS_LOG_LEVEL 3
+#endif
+
+// EMS_LOG_BINARY=1 logs packed records (format hash, time, raw arguments)
+// instead of text; decode_log.py turns them back into lines.
+#ifndef EMS_LOG_BINARY
+#define EMS_LOG_BINARY 0
+#endif
+
+// EMS_BENCH=1 times the control tick, web handlers and HTTP calls and
+// serves latency percentiles, allocations and free heap at /api/bench.
+#ifndef EMS_BENCH
+#define EMS_BENCH 0
+#endif
+
+// Tags benchmark reports; builds can pass a git describe instead
+#ifndef EMS_BUILD_ID
+#define EMS_BUILD_ID __DATE__ " " __TIME__
+#endif
+#ifndef EMS_BENCH_TARGET
+#define EMS_BENCH_TARGET "esp32"
+#endif
 
 // ===== WiFi Configuration =====
 const char* ssid = "YOUR_WIFI_NAME";
 const char* password = "YOUR_PASSWORD";
 
+// Static address, skips DHCP. Leave STATIC_IP at 0.0.0.0 to use DHCP.
+const IPAddress STATIC_IP(0, 0, 0, 0);
+const IPAddress STATIC_GATEWAY(192, 168, 1, 1);
+const IPAddress STATIC_SUBNET(255, 255, 255, 0);
+const IPAddress STATIC_DNS(192, 168, 1, 1);
+const bool WIFI_REUSE_LEASE = false;   // With DHCP: rejoin with the last lease from NVS
+
 // ===== Database API Configuration =====
 // You'll need to run a Python server that serves the database data
 const char* API_SERVER = "http://192.168.1.100:5000";  // Change to your server IP
+// Sent as X-Device-Id so the server keeps each device's rows apart.
+// Leave empty to use the WiFi MAC.
+const char* DEVICE_ID = "";
 
 WebServer server(80);
 
-// ===== Relay Pins =====
-int relayPins[6] = {5, 18, 19, 21, 22, 23};
-int waterHeaterPin = 4;
+// ===== Device Table =====
+// One row per switched circuit. Control, relays, JSON and the status page
+// are all driven from this table, and device state is a bitmask with bit i
+// for row i. Adding a circuit is adding a row.
+enum DeviceClass : uint8_t {
+  DEVICE_CRITICAL,     // Always on
+  DEVICE_NIGHT,        // On outside daylight hours
+  DEVICE_COMFORT,      // On when there is power to spare
+  DEVICE_DEFERRABLE    // Like comfort, and the dispatch plan may hold it off
+};
+
+struct DeviceDescriptor {
+  uint8_t pin;
+  const char* name;
+  uint16_t load;           // Rated W
+  DeviceClass priority;
+  uint8_t minSocOn;        // % battery needed to switch on, 0 = any
+  uint8_t offBelowSoc;     // % battery below which it is switched off, 0 = never
+  uint16_t minOnTime;      // s
+  uint16_t minOffTime;     // s
+  bool sheddable;          // Dropped first when the battery is critical
+};
+
+constexpr DeviceDescriptor DEVICE_TABLE[] = {
+  // pin  name       load  priority           minSoc offBelow minOn minOff shed
+  {5,   "Fridge",   150,  DEVICE_CRITICAL,   0,     0,       0,    0,     false},
+  {18,  "Heater",   200,  DEVICE_COMFORT,    0,     0,       60,   60,    true},
+  {19,  "Light",    100,  DEVICE_NIGHT,      0,     0,       0,    0,     false},
+  {21,  "Router",   50,   DEVICE_CRITICAL,   0,     0,       0,    0,     false},
+  {22,  "Washing",  500,  DEVICE_DEFERRABLE, 0,     0,       600,  60,    true},
+  {23,  "AC",       1200, DEVICE_DEFERRABLE, 50,    30,      300,  180,   true},
+};
+constexpr int DEVICE_COUNT = sizeof(DEVICE_TABLE) / sizeof(DEVICE_TABLE[0]);
+
+// Not part of the device list: manageEnergy() drives it from surplus power
+constexpr DeviceDescriptor WATER_HEATER = {4, "Water Heater", 1500, DEVICE_COMFORT, 0, 0, 120, 120, true};
+
+typedef uint32_t DeviceMask;
+static_assert(DEVICE_COUNT <= 31, "DeviceMask holds up to 31 circuits plus the water heater bit");
+
+constexpr DeviceMask deviceBit(int i) {
+  return (DeviceMask)1 << i;
+}
+
+constexpr DeviceMask devicesOfClass(DeviceClass priority, int i = 0) {
+  return i == DEVICE_COUNT ? 0 : (DEVICE_TABLE[i].priority == priority ? deviceBit(i) : 0) | devicesOfClass(priority, i + 1);
+}
+
+constexpr DeviceMask sheddableDevices(int i = 0) {
+  return i == DEVICE_COUNT ? 0 : (DEVICE_TABLE[i].sheddable ? deviceBit(i) : 0) | sheddableDevices(i + 1);
+}
+
+constexpr float ratedLoad(DeviceMask mask, int i = 0) {
+  return i == DEVICE_COUNT ? 0 : ((mask & deviceBit(i)) ? DEVICE_TABLE[i].load : 0) + ratedLoad(mask, i + 1);
+}
+
+// Relay outputs go through the GPIO0-31 set/clear registers
+constexpr bool pinsFitOutRegister(int i = 0) {
+  return i == DEVICE_COUNT || (DEVICE_TABLE[i].pin < 32 && pinsFitOutRegister(i + 1));
+}
+static_assert(pinsFitOutRegister() && WATER_HEATER.pin < 32, "Relay pins must be GPIO0-31");
+
+constexpr uint32_t relayGpioBits(DeviceMask mask, int i = 0) {
+  return i == DEVICE_COUNT ? 0 : ((mask & deviceBit(i)) ? 1UL << DEVICE_TABLE[i].pin : 0) | relayGpioBits(mask, i + 1);
+}
+
+constexpr DeviceMask ALL_DEVICES = deviceBit(DEVICE_COUNT) - 1;
+constexpr DeviceMask CRITICAL_DEVICES = devicesOfClass(DEVICE_CRITICAL);
+constexpr DeviceMask NIGHT_DEVICES = devicesOfClass(DEVICE_NIGHT);
+constexpr DeviceMask DEFERRABLE_DEVICES = devicesOfClass(DEVICE_DEFERRABLE);
+constexpr DeviceMask FLEXIBLE_DEVICES = devicesOfClass(DEVICE_COMFORT) | DEFERRABLE_DEVICES;
+constexpr DeviceMask SHEDDABLE_DEVICES = sheddableDevices();
+constexpr uint32_t RELAY_GPIO_MASK = relayGpioBits(ALL_DEVICES) | (1UL << WATER_HEATER.pin);
 
-// Device names
-const char* deviceNames[6] = {"Fridge", "Heater", "Light", "Router", "Washing", "AC"};
+inline bool deviceOn(DeviceMask mask, int i) {
+  return mask & deviceBit(i);
+}
 
-// Device states
-bool devices[6];
+// Device states, as the relays currently are
+DeviceMask deviceState = 0;
 bool waterHeater = false;
 bool gridPower = false;
 
-// Device loads (Watts)
-float deviceLoad[6] = {150, 200, 100, 50, 500, 1200};
-float waterHeaterLoad = 1500;
+// What the control logic wants; updateRelays() moves the relays toward it
+DeviceMask deviceRequest = 0;
+bool waterHeaterRequest = false;
+
+constexpr float waterHeaterLoad = WATER_HEATER.load;
 
 // System data from AI predictions
 float predictedPvPower = 0;
@@ -36,32 +253,376 @@ float predictedConsumption = 0;
 float currentPvPower = 0;
 float totalLoad = 0;
 float batterySOC = 70;
-float batteryCapacity = 10000;  // 10 kWh in Wh
-float maxBatteryPower = 3000;   // Max charge/discharge rate in W
+constexpr float batteryCapacity = 10000;   // 10 kWh in Wh
+constexpr float maxBatteryPower = 3000;    // Max charge/discharge rate in W
+constexpr float CHARGE_EFFICIENCY = 0.92;
+constexpr float DISCHARGE_EFFICIENCY = 0.90;
 
 bool autoMode = true;
-unsigned long lastApiCall = 0;
-const unsigned long API_INTERVAL = 60000;  // Update every 1 minute
+const unsigned long CONTROL_INTERVAL = 2000;     // Control tick every 2 seconds
+#if EMS_PREDICTION_CACHE
+const unsigned long API_INTERVAL = 600000;       // Interpolated in between, see Prediction Cache
+#else
+const unsigned long API_INTERVAL = 60000;        // Update every 1 minute
+#endif
+const unsigned long TELEMETRY_INTERVAL = 60000;  // Push status every 1 minute
+const unsigned long TELEMETRY_OFFSET = 30000;    // Keep telemetry away from the prediction fetch
+
+// ===== Prediction Fetch Policy =====
+const unsigned long FETCH_POLL_INTERVAL = 1000;        // How often the scheduler checks for a due fetch
+const uint16_t HTTP_CONNECT_TIMEOUT_MS = 2000;
+const uint16_t HTTP_READ_TIMEOUT_MS = 3000;
+const unsigned long FETCH_BACKOFF_MIN = 5000;          // First retry after a failure
+const unsigned long FETCH_BACKOFF_MAX = 300000;        // Never wait longer than 5 minutes
+const unsigned long PREDICTION_MAX_AGE = 3 * API_INTERVAL;  // Older predictions fall back to clear-sky PV
+const float STALE_PV_DERATE = 0.5;                     // Assume half of clear-sky when flying blind
+const unsigned long FORECAST_INTERVAL = 3600000;       // 24 h forecast refresh every hour
+const unsigned long FORECAST_RETRY_INTERVAL = 60000;
+const unsigned long FORECAST_MAX_AGE = 21600000;       // Stop planning on a forecast older than 6 h
+
+// Clear-sky PV profile by hour (W), used when predictions are stale
+const float CLEAR_SKY_PV[24] = {
+  0, 0, 0, 0, 0, 0, 150, 600, 1200, 1900, 2600, 3100,
+  3400, 3400, 3100, 2600, 1900, 1200, 500, 0, 0, 0, 0, 0
+};
+
+// Age tracking for the last applied prediction (control loop only)
+bool havePrediction = false;
+unsigned long predictionReceivedAt = 0;
 
 // Statistics
-float dailyPvGeneration = 0;
-float dailyConsumption = 0;
-float dailyGridImport = 0;
+// Energy totals in Wh since local midnight, integrated by manageEnergy()
+struct EnergyTotals {
+  float pvGeneration;
+  float consumption;
+  float batteryCharge;
+  float batteryDischarge;
+  float gridImport;
+};
+
+EnergyTotals dailyEnergy = {};
 float systemEfficiency = 92.0;
 
+#if EMS_DUAL_CORE
+const BaseType_t CONTROL_CORE = 1;
+const BaseType_t NETWORK_CORE = 0;                       // Same core as the WiFi stack
+const UBaseType_t CONTROL_TASK_PRIORITY = configMAX_PRIORITIES - 2;
+const UBaseType_t NETWORK_TASK_PRIORITY = 2;
+const uint32_t CONTROL_TASK_STACK = 6144;   // Room for the status serializer
+const uint32_t NETWORK_TASK_STACK = 8192;
+#endif
+
+// HTTP calls run in their own worker so nothing else waits on the network
+const BaseType_t HTTP_WORKER_CORE = 0;
+const UBaseType_t HTTP_WORKER_PRIORITY = 1;
+const uint32_t HTTP_WORKER_STACK = 8192;
+
+// The dispatch planner solves in the background at the lowest priority
+const BaseType_t PLANNER_CORE = 0;
+const UBaseType_t PLANNER_PRIORITY = 1;
+const uint32_t PLANNER_STACK = 4096;
+
+// Metering DSP runs on the application core, away from the WiFi stack
+const BaseType_t METER_CORE = 1;
+const UBaseType_t METER_PRIORITY = 2;
+const uint32_t METER_STACK = 4096;
+
+// The MQTT client blocks on its socket, so it gets a task of its own
+const BaseType_t MQTT_CORE = 0;
+const UBaseType_t MQTT_PRIORITY = 1;
+const uint32_t MQTT_STACK = 4096;
+
+// Fleet frames are handled next to the WiFi stack that delivers them
+const BaseType_t FLEET_CORE = 0;
+const UBaseType_t FLEET_PRIORITY = 2;
+const uint32_t FLEET_STACK = 4096;
+
+// Console output drains to the UART below everything else on the network core
+const BaseType_t CONSOLE_CORE = 0;
+const UBaseType_t CONSOLE_PRIORITY = 1;
+const uint32_t CONSOLE_STACK = 2048;
+
+// ===== Logging =====
+// LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG take printf arguments. Levels above
+// EMS_LOG_LEVEL compile to nothing, arguments included. An enabled call
+// formats its line (or packs a binary record) into a RAM ring and returns;
+// the console task moves the ring to the UART only as fast as the TX FIFO has
+// room, so no caller ever waits on the serial port. A full ring drops the
+// message and counts it.
+//
+// Binary records are [LOG_SYNC, length, level, format hash (4), millis (4),
+// arguments], each argument a type tag and its raw bytes. The format string
+// itself never reaches the flash; decode_log.py finds it in this file by
+// the same FNV-1a hash.
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+const size_t CONSOLE_RING_SIZE = 4096;
+const size_t LOG_LINE_MAX = 160;
+const TickType_t CONSOLE_DRAIN_TICKS = pdMS_TO_TICKS(10);
+
+uint8_t consoleRing[CONSOLE_RING_SIZE];
+size_t consoleHead = 0;                 // Free-running; both under consoleLock
+size_t consoleTail = 0;
+portMUX_TYPE consoleLock = portMUX_INITIALIZER_UNLOCKED;
+std::atomic<uint32_t> consoleOverruns{0};
+
+void consoleWrite(const uint8_t* data, size_t length) {
+  portENTER_CRITICAL(&consoleLock);
+  bool fits = CONSOLE_RING_SIZE - (consoleHead - consoleTail) >= length;
+  if (fits) {
+    size_t at = consoleHead % CONSOLE_RING_SIZE;
+    size_t first = min(length, CONSOLE_RING_SIZE - at);
+    memcpy(consoleRing + at, data, first);
+    memcpy(consoleRing, data + first, length - first);
+    consoleHead += length;
+  }
+  portEXIT_CRITICAL(&consoleLock);
+  if (!fits) consoleOverruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Writes what the UART can take without blocking; the bytes stay in the
+// ring until written, so producers never overwrite them
+void consoleDrain() {
+  for (;;) {
+    portENTER_CRITICAL(&consoleLock);
+    size_t at = consoleTail % CONSOLE_RING_SIZE;
+    size_t length = min(consoleHead - consoleTail, CONSOLE_RING_SIZE - at);
+    portEXIT_CRITICAL(&consoleLock);
+    length = min(length, (size_t)Serial.availableForWrite());
+    if (length == 0) return;
+    
+    Serial.write(consoleRing + at, length);
+    portENTER_CRITICAL(&consoleLock);
+    consoleTail += length;
+    portEXIT_CRITICAL(&consoleLock);
+  }
+}
+
+void consoleTask(void* parameter) {
+  for (;;) {
+    consoleDrain();
+    vTaskDelay(CONSOLE_DRAIN_TICKS);
+  }
+}
+
+void startConsole() {
+  xTaskCreatePinnedToCore(consoleTask, "console", CONSOLE_STACK, NULL, CONSOLE_PRIORITY, NULL, CONSOLE_CORE);
+}
+
+// Type-checks the arguments of compiled-out and binary calls, never runs
+inline void logFormatCheck(const char* format, ...) __attribute__((format(printf, 1, 2)));
+inline void logFormatCheck(const char* format, ...) {}
+
+#if EMS_LOG_BINARY
+const uint8_t LOG_SYNC = 0xA5;
+const size_t LOG_HEADER = 11;
+const size_t LOG_STRING_MAX = 48;
+
+enum LogArgType : uint8_t { LOG_ARG_INT = 'i', LOG_ARG_INT64 = 'I', LOG_ARG_FLOAT = 'f', LOG_ARG_STRING = 's' };
+
+constexpr uint32_t logHash(const char* text, uint32_t hash = 2166136261u) {
+  return *text ? logHash(text + 1, (hash ^ (uint8_t)*text) * 16777619u) : hash;
+}
+
+struct LogRecord {
+  uint8_t bytes[LOG_LINE_MAX];
+  size_t length = LOG_HEADER;
+
+  void put(const void* data, size_t size) {
+    if (length + size > sizeof(bytes)) return;
+    memcpy(bytes + length, data, size);
+    length += size;
+  }
+  void tagged(LogArgType type, const void* data, size_t size) {
+    if (length + 1 + size > sizeof(bytes)) return;
+    bytes[length++] = type;
+    put(data, size);
+  }
+};
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type logPack(LogRecord& record, T value) {
+  if (sizeof(T) > 4) {
+    int64_t wide = (int64_t)value;
+    record.tagged(LOG_ARG_INT64, &wide, sizeof(wide));
+  } else {
+    int32_t narrow = (int32_t)value;
+    record.tagged(LOG_ARG_INT, &narrow, sizeof(narrow));
+  }
+}
+
+inline void logPack(LogRecord& record, double value) {
+  float narrow = (float)value;
+  record.tagged(LOG_ARG_FLOAT, &narrow, sizeof(narrow));
+}
+
+inline void logPack(LogRecord& record, const char* text) {
+  uint8_t length = text ? min(strlen(text), LOG_STRING_MAX) : 0;
+  if (record.length + 2 + length > sizeof(record.bytes)) return;
+  record.bytes[record.length++] = LOG_ARG_STRING;
+  record.bytes[record.length++] = length;
+  record.put(text, length);
+}
+
+template <typename... Args>
+void logRecord(uint8_t level, uint32_t hash, Args... args) {
+  LogRecord record;
+  int unpacked[] = {0, (logPack(record, args), 0)...};
+  (void)unpacked;
+  uint32_t now = millis();
+  record.bytes[0] = LOG_SYNC;
+  record.bytes[1] = record.length - LOG_HEADER;
+  record.bytes[2] = level;
+  memcpy(record.bytes + 3, &hash, 4);
+  memcpy(record.bytes + 7, &now, 4);
+  consoleWrite(record.bytes, record.length);
+}
+
+#define LOG_AT(level, format, ...) do { \
+    if (0) logFormatCheck(format, ##__VA_ARGS__); \
+    logRecord(level, std::integral_constant<uint32_t, logHash(format)>::value, ##__VA_ARGS__); \
+  } while (0)
+#else
+void logText(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void logText(const char* format, ...) {
+  char line[LOG_LINE_MAX];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line) - 1, format, args);
+  va_end(args);
+  if (length < 0) return;
+  length = min(length, (int)sizeof(line) - 2);
+  line[length++] = '\n';
+  consoleWrite((const uint8_t*)line, length);
+}
+
+#define LOG_AT(level, format, ...) logText(format, ##__VA_ARGS__)
+#endif
+
+#define LOG_OFF(format, ...) do { if (0) logFormatCheck(format, ##__VA_ARGS__); } while (0)
+
+#if EMS_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) LOG_OFF(format, ##__VA_ARGS__)
+#endif
+#if EMS_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) LOG_OFF(format, ##__VA_ARGS__)
+#endif
+#if EMS_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_OFF(format, ##__VA_ARGS__)
+#endif
+#if EMS_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_OFF(format, ##__VA_ARGS__)
+#endif
+
+// ===== Shared State =====
+// Single-writer double buffer. The writer fills the slot readers are not
+// using and then bumps `version`; a reader copies the current slot and
+// retries if a publish landed mid-copy. Neither side ever takes a lock.
+template <typename T>
+class SnapshotBuffer {
+ public:
+  void publish(const T& value) {
+    uint32_t next = version.load(std::memory_order_relaxed) + 1;
+    slots[next & 1] = value;
+    version.store(next, std::memory_order_release);
+  }
+
+  uint32_t read(T& out) const {
+    uint32_t seen;
+    do {
+      seen = version.load(std::memory_order_acquire);
+      out = slots[seen & 1];
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (version.load(std::memory_order_relaxed) != seen);
+    return seen;
+  }
+
+  // In-place variant of publish() for payloads too large to build on the
+  // stack: fill the slot returned by writeSlot(), then commit()
+  T& writeSlot() {
+    return slots[(version.load(std::memory_order_relaxed) + 1) & 1];
+  }
+
+  void commit() {
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  uint32_t currentVersion() const {
+    return version.load(std::memory_order_acquire);
+  }
+
+ private:
+  T slots[2] = {};
+  std::atomic<uint32_t> version{0};
+};
+
+// Published by the control loop after every tick, read by the web server
+// and the telemetry uplink
+struct ControlSnapshot {
+  DeviceMask devices;
+  uint16_t switchesToday[DEVICE_COUNT + 1];   // Devices, then the water heater
+  bool waterHeater;
+  bool gridPower;
+  bool autoMode;
+  bool predictionStale;
+  bool metered;                  // PV and load are measured, not estimated
+  bool loadShedding;
+  unsigned long predictionAge;   // ms since the last prediction arrived
+  float currentPvPower;
+  float totalLoad;
+  float batterySOC;
+  float systemEfficiency;
+  float predictedPvPower;
+  float predictedConsumption;
+  EnergyTotals dailyEnergy;
+};
+
+// Published by fetchPredictions(), applied by the control loop on its next tick.
+// Battery SOC is not part of it: the device's own estimate is the only one.
+struct PredictionInput {
+  float pvPower;
+  float consumption;
+  unsigned long receivedAt;      // millis() when the response arrived
+};
+
+SnapshotBuffer<ControlSnapshot> controlState;
+SnapshotBuffer<PredictionInput> predictionState;
+uint32_t appliedPredictionVersion = 0;
+
 // ===== Time Configuration =====
+// Started once the link is up; SNTP sets the clock in the background.
+// Every hour of day on the device (forecast slots, the plan, daily totals,
+// the on-device model) is local time in TIME_ZONE, a POSIX TZ string such as
+// "CET-1CEST,M3.5.0,M10.5.0/3". Forecast rows are placed by their Unix time,
+// so the server may run in another zone; tiny_model.h is fitted on the
+// server's local timestamps, so its TINY_SOLAR_NOON assumes the same zone.
+const char* TIME_ZONE = "UTC0";
+
 void initTime() {
-  configTime(0, 0, "pool.ntp.org");
-  struct tm timeinfo;
-  if (getLocalTime(&timeinfo)) {
-    Serial.println("Time synchronized");
-  }
+  configTzTime(TIME_ZONE, "pool.ntp.org");
+}
+
+uint32_t unixTime() {
+  time_t now = time(NULL);
+  return now > 1600000000 ? (uint32_t)now : 0;  // Before 2020 means NTP never synced
 }
 
 // ===== Get current hour =====
+// Noon until NTP has set the clock
 int getCurrentHour() {
   struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) return 12;
+  if (!getLocalTime(&timeinfo, 0)) return 12;   // Never wait in the control loop
   return timeinfo.tm_hour;
 }
 
@@ -71,154 +632,2604 @@ bool isDaytime() {
   return (hour >= 6 && hour <= 18);
 }
 
+// ===== Benchmarks =====
+// A BENCH_SCOPE at the top of a function records its duration, the heap
+// allocations made while it ran and the free heap when it returned. Each
+// probe is written from one task only; a report read mid-update at worst
+// blurs a percentile. Without EMS_BENCH the scopes compile to nothing.
+#if EMS_BENCH
+const int BENCH_SAMPLES = 256;          // Latest durations kept per probe
+
+enum BenchProbe : uint8_t {
+  BENCH_MANAGE_ENERGY,
+  BENCH_HANDLE_ROOT,
+  BENCH_HANDLE_API_DATA,
+  BENCH_FETCH_PREDICTIONS,
+  BENCH_SEND_STATUS,
+  BENCH_SYNC,
+  BENCH_TINY_MODEL,
+  BENCH_PROBES
+};
+
+const char* const BENCH_NAMES[BENCH_PROBES] = {
+  "manageEnergy", "handleRoot", "handleApiData", "fetchPredictions", "sendStatusToDatabase", "syncWithServer",
+  "tinyModelPredict"
+};
+
+struct BenchStats {
+  uint32_t samples[BENCH_SAMPLES];      // us, ring
+  std::atomic<uint32_t> calls;
+  std::atomic<uint32_t> maxUs;
+  std::atomic<uint32_t> allocs;
+  std::atomic<uint32_t> allocBytes;
+  std::atomic<uint32_t> minFreeHeap;
+};
+
+BenchStats benchStats[BENCH_PROBES];
+
+// With heap hooks in the core every allocation is counted, from any task
+// while the probe runs. Otherwise the count is the net change in allocated
+// blocks, which still shows leaks and retained buffers.
+#ifdef CONFIG_HEAP_USE_HOOKS
+const char* const BENCH_ALLOC_COUNT = "gross";
+std::atomic<uint32_t> heapAllocs{0};
+std::atomic<uint32_t> heapAllocBytes{0};
+
+extern "C" void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) {
+  heapAllocs.fetch_add(1, std::memory_order_relaxed);
+  heapAllocBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+extern "C" void esp_heap_trace_free_hook(void* ptr) {}
+
+void benchHeapCounters(uint32_t& blocks, uint32_t& bytes) {
+  blocks = heapAllocs.load(std::memory_order_relaxed);
+  bytes = heapAllocBytes.load(std::memory_order_relaxed);
+}
+#else
+const char* const BENCH_ALLOC_COUNT = "net";
+
+void benchHeapCounters(uint32_t& blocks, uint32_t& bytes) {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  blocks = info.allocated_blocks;
+  bytes = info.total_allocated_bytes;
+}
+#endif
+
+void initBench() {
+  for (int i = 0; i < BENCH_PROBES; i++) {
+    benchStats[i].minFreeHeap.store(UINT32_MAX, std::memory_order_relaxed);
+  }
+}
+
+class BenchScope {
+ public:
+  explicit BenchScope(BenchProbe probe) : probe(probe) {
+    benchHeapCounters(startBlocks, startBytes);
+    startUs = esp_timer_get_time();
+  }
+
+  ~BenchScope() {
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - startUs);
+    uint32_t blocks, bytes;
+    benchHeapCounters(blocks, bytes);
+    uint32_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    
+    BenchStats& stats = benchStats[probe];
+    uint32_t call = stats.calls.load(std::memory_order_relaxed);
+    stats.samples[call % BENCH_SAMPLES] = elapsed;
+    stats.calls.store(call + 1, std::memory_order_release);
+    if (elapsed > stats.maxUs.load(std::memory_order_relaxed)) stats.maxUs.store(elapsed, std::memory_order_relaxed);
+    stats.allocs.fetch_add(blocks - startBlocks, std::memory_order_relaxed);
+    stats.allocBytes.fetch_add(bytes - startBytes, std::memory_order_relaxed);
+    if (freeHeap < stats.minFreeHeap.load(std::memory_order_relaxed)) stats.minFreeHeap.store(freeHeap, std::memory_order_relaxed);
+  }
+
+ private:
+  BenchProbe probe;
+  int64_t startUs;
+  uint32_t startBlocks;
+  uint32_t startBytes;
+};
+
+#define BENCH_SCOPE(probe) BenchScope benchScope(probe)
+#else
+#define BENCH_SCOPE(probe)
+#endif
+
+// ===== Metrics =====
+// Counters for /metrics. Every value is a std::atomic updated with relaxed
+// adds where it happens, so recording never waits and a scrape only loads
+// them. Latencies go into fixed histogram buckets (stored per bucket, made
+// cumulative when scraped). Sums are 32-bit microseconds and wrap after
+// about 70 minutes of total time, which rate() treats as a counter reset.
+#if EMS_METRICS
+constexpr uint32_t METRIC_BUCKETS_US[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                          100000, 250000, 1000000, 5000000};
+constexpr int METRIC_BUCKET_COUNT = sizeof(METRIC_BUCKETS_US) / sizeof(METRIC_BUCKETS_US[0]);
+
+enum MetricTimer : uint8_t {
+  METRIC_CONTROL_TICK,
+  METRIC_HANDLE_ROOT,
+  METRIC_HANDLE_API_DATA,
+  METRIC_FETCH_PREDICTIONS,
+  METRIC_SEND_STATUS,
+  METRIC_SYNC,
+  METRIC_FETCH_FORECAST,
+  METRIC_TIMERS
+};
+
+struct LatencyHistogram {
+  std::atomic<uint32_t> buckets[METRIC_BUCKET_COUNT + 1];   // Last is +Inf
+  std::atomic<uint32_t> sumUs;
+  std::atomic<uint32_t> failures;                           // API calls only
+
+  void record(uint32_t us) {
+    int bucket = std::lower_bound(METRIC_BUCKETS_US, METRIC_BUCKETS_US + METRIC_BUCKET_COUNT, us) - METRIC_BUCKETS_US;
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(us, std::memory_order_relaxed);
+  }
+};
+
+LatencyHistogram metricTimers[METRIC_TIMERS];
+std::atomic<uint32_t> relaySwitchTotal[DEVICE_COUNT + 1];   // Devices, then the water heater
+std::atomic<uint32_t> tripTotal[3];                        // Grid lost, overcurrent, watchdog
+std::atomic<uint32_t> wifiConnects{0};
+
+class MetricScope {
+ public:
+  explicit MetricScope(MetricTimer timer) : timer(timer), startUs(esp_timer_get_time()) {}
+  ~MetricScope() { metricTimers[timer].record((uint32_t)(esp_timer_get_time() - startUs)); }
+
+ private:
+  MetricTimer timer;
+  int64_t startUs;
+};
+
+void countRelaySwitch(int channel) {
+  relaySwitchTotal[channel].fetch_add(1, std::memory_order_relaxed);
+}
+
+void countTrips(uint32_t trips) {
+  for (int i = 0; i < 3; i++) {
+    if (trips & (1UL << i)) tripTotal[i].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void onWifiGotIp(WiFiEvent_t event) {
+  wifiConnects.fetch_add(1, std::memory_order_relaxed);
+}
+
+#define METRIC_SCOPE(timer) MetricScope metricScope(timer)
+#define METRIC_FAILURE(timer) metricTimers[timer].failures.fetch_add(1, std::memory_order_relaxed)
+#else
+#define METRIC_SCOPE(timer)
+#define METRIC_FAILURE(timer) do {} while (0)
+void countRelaySwitch(int channel) {}
+void countTrips(uint32_t trips) {}
+#endif
+
+// ===== API Connection =====
+// One long-lived client for every call to API_SERVER, used only by the HTTP
+// worker. With setReuse(true) and a keep-alive server the TCP connection
+// survives between requests, and the URLs are built once at startup.
+WiFiClient apiSocket;
+HTTPClient apiClient;
+char predictionUrl[128];
+char statusUrl[128];
+char syncUrl[128];
+char replayUrl[128];
+char forecastUrl[128];
+char deviceId[33];
+
+void initApiClient() {
+  snprintf(predictionUrl, sizeof(predictionUrl), "%s/api/current_prediction", API_SERVER);
+#if EMS_TELEMETRY_BINARY
+  snprintf(statusUrl, sizeof(statusUrl), "%s/api/update_status_bin", API_SERVER);
+#else
+  snprintf(statusUrl, sizeof(statusUrl), "%s/api/update_status", API_SERVER);
+#endif
+  snprintf(syncUrl, sizeof(syncUrl), "%s/api/sync", API_SERVER);
+  snprintf(replayUrl, sizeof(replayUrl), "%s/api/update_status_bin", API_SERVER);
+  snprintf(forecastUrl, sizeof(forecastUrl), "%s/api/forecast", API_SERVER);
+  
+  if (DEVICE_ID[0] != '\0') {
+    snprintf(deviceId, sizeof(deviceId), "%s", DEVICE_ID);
+  } else {
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    snprintf(deviceId, sizeof(deviceId), "%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+  
+  apiClient.setReuse(true);
+  apiClient.setConnectTimeout(HTTP_CONNECT_TIMEOUT_MS);
+  apiClient.setTimeout(HTTP_READ_TIMEOUT_MS);
+}
+
+// ===== JSON Documents =====
+// Fixed capacities so no hot path allocates a JSON document on the heap.
+// Key strings are linked, not copied, when they come from const char*.
+const size_t STATE_JSON_CAPACITY = JSON_OBJECT_SIZE(16) + JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(DEVICE_COUNT) +
+                                   DEVICE_COUNT * JSON_OBJECT_SIZE(4);
+const size_t PREDICTION_JSON_CAPACITY = JSON_OBJECT_SIZE(2) + 32;  // + copied key names
+const size_t STATUS_JSON_SIZE = 640 + DEVICE_COUNT * 80;
+
+// Parse a prediction straight from the response stream and hand it to the
+// control loop. The filter drops every field except the two we use.
+// Relies on the server sending Content-Length (not chunked), as Flask does.
+bool parsePrediction(Stream& body, SnapshotBuffer<PredictionInput>& target) {
+  StaticJsonDocument<64> filter;
+  filter["pv_power"] = true;
+  filter["consumption"] = true;
+  
+  StaticJsonDocument<PREDICTION_JSON_CAPACITY> doc;
+  DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(filter));
+  
+  if (error) {
+    LOG_WARN("JSON parsing failed: %s", error.c_str());
+    return false;
+  }
+  
+  PredictionInput input;
+  input.pvPower = doc["pv_power"] | 0.0f;
+  input.consumption = doc["consumption"] | 0.0f;
+  input.receivedAt = millis();
+  target.publish(input);
+  
+  LOG_INFO("Predicted PV: %.1f W, Consumption: %.1f W", input.pvPower, input.consumption);
+  return true;
+}
+
+// ===== Forecast =====
+// /api/forecast returns up to 24 hourly rows. They are folded into a profile
+// indexed by hour of day (whole watts), so the planner can start its horizon
+// at any hour without caring where the server's list began. Rows are placed
+// by their Unix "time"; only the current hour and the 23 after it are kept,
+// so a stale list cannot pass for today's.
+const int FORECAST_HOURS = 24;
+const size_t FORECAST_JSON_CAPACITY = JSON_ARRAY_SIZE(FORECAST_HOURS) + FORECAST_HOURS * JSON_OBJECT_SIZE(3)
+                                      + 48;  // + copied keys
+
+struct ForecastProfile {
+  uint16_t pvPower[FORECAST_HOURS];
+  uint16_t consumption[FORECAST_HOURS];
+  uint32_t hoursPresent;         // Bit h set when hour h came from the server
+  unsigned long receivedAt;
+};
+
+SnapshotBuffer<ForecastProfile> forecastState;
+
+uint16_t clampWatts(float value) {
+  if (value <= 0) return 0;
+  if (value >= 65535) return 65535;
+  return (uint16_t)(value + 0.5);
+}
+
+bool parseForecast(Stream& body) {
+  uint32_t now = unixTime();
+  if (now == 0) {
+    LOG_WARN("Forecast ignored: clock not set");
+    return false;
+  }
+  
+  StaticJsonDocument<96> filter;
+  filter[0]["time"] = true;
+  filter[0]["pv_power"] = true;
+  filter[0]["consumption"] = true;
+  
+  StaticJsonDocument<FORECAST_JSON_CAPACITY> doc;
+  DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(filter));
+  
+  if (error) {
+    LOG_WARN("Forecast parsing failed: %s", error.c_str());
+    return false;
+  }
+  
+  ForecastProfile forecast = {};
+  int skipped = 0;
+  for (JsonObject row : doc.as<JsonArray>()) {
+    time_t at = row["time"] | 0L;
+    // The row whose hour is under way, and the FORECAST_HOURS - 1 after it
+    if (at + 3600 <= (time_t)now || at > (time_t)now + (FORECAST_HOURS - 1) * 3600L) {
+      skipped++;
+      continue;
+    }
+    struct tm local;
+    localtime_r(&at, &local);
+    int hour = local.tm_hour;
+    
+    forecast.pvPower[hour] = clampWatts(row["pv_power"] | 0.0f);
+    forecast.consumption[hour] = clampWatts(row["consumption"] | 0.0f);
+    forecast.hoursPresent |= 1UL << hour;
+  }
+  
+  if (skipped) LOG_WARN("Forecast: %d rows outside the next %d h", skipped, FORECAST_HOURS);
+  if (forecast.hoursPresent == 0) return false;
+  forecast.receivedAt = millis();
+  forecastState.publish(forecast);
+  
+  LOG_INFO("Forecast received: %d hours", __builtin_popcount(forecast.hoursPresent));
+  return true;
+}
+
+// ===== State JSON =====
+// Writes the status fields of `state` into `doc`. With `previous` set, only
+// fields that changed since that snapshot are written and `previous` is
+// updated to match, which is how the event stream builds delta frames.
+bool floatChanged(float value, float& last) {
+  if (fabsf(value - last) < 0.05f) return false;  // Below display resolution
+  last = value;
+  return true;
+}
+
+bool flagChanged(bool value, bool& last) {
+  if (value == last) return false;
+  last = value;
+  return true;
+}
+
+void writeStateJson(JsonDocument& doc, const ControlSnapshot& state, ControlSnapshot* previous) {
+  ControlSnapshot scratch = {};
+  bool full = (previous == NULL);
+  ControlSnapshot& last = full ? scratch : *previous;
+  
+  if (floatChanged(state.currentPvPower, last.currentPvPower) || full) doc["pv_power"] = state.currentPvPower;
+  if (floatChanged(state.totalLoad, last.totalLoad) || full) doc["consumption"] = state.totalLoad;
+  if (floatChanged(state.batterySOC, last.batterySOC) || full) doc["battery_soc"] = state.batterySOC;
+  if (flagChanged(state.gridPower, last.gridPower) || full) doc["grid_power"] = state.gridPower;
+  if (floatChanged(state.systemEfficiency, last.systemEfficiency) || full) doc["efficiency"] = state.systemEfficiency;
+  if (state.predictionAge / 1000 != last.predictionAge / 1000 || full) {
+    last.predictionAge = state.predictionAge;
+    doc["prediction_age"] = state.predictionAge / 1000;
+  }
+  if (flagChanged(state.predictionStale, last.predictionStale) || full) doc["prediction_stale"] = state.predictionStale;
+  if (flagChanged(state.metered, last.metered) || full) doc["metered"] = state.metered;
+  if (floatChanged(state.predictedPvPower, last.predictedPvPower) || full) doc["predicted_pv"] = state.predictedPvPower;
+  if (floatChanged(state.predictedConsumption, last.predictedConsumption) || full) doc["predicted_consumption"] = state.predictedConsumption;
+  if (flagChanged(state.autoMode, last.autoMode) || full) doc["auto_mode"] = state.autoMode;
+  if (flagChanged(state.waterHeater, last.waterHeater) || full) {
+    doc["water_heater"] = state.waterHeater;
+    doc["water_heater_power"] = state.waterHeater ? waterHeaterLoad : 0;
+    doc["water_heater_switches"] = state.switchesToday[DEVICE_COUNT];
+  }
+  
+  if (state.devices != last.devices || full) {
+    last.devices = state.devices;
+    JsonArray devicesArray = doc.createNestedArray("devices");
+    for (int i = 0; i < DEVICE_COUNT; i++) {
+      JsonObject device = devicesArray.createNestedObject();
+      device["name"] = DEVICE_TABLE[i].name;
+      device["status"] = deviceOn(state.devices, i);
+      device["power"] = deviceOn(state.devices, i) ? DEVICE_TABLE[i].load : 0;
+      device["switches_today"] = state.switchesToday[i];
+    }
+  }
+  
+  // Counters move every tick; keep them out of delta frames
+  if (full) {
+    JsonObject energy = doc.createNestedObject("energy_today");
+    energy["pv_wh"] = state.dailyEnergy.pvGeneration;
+    energy["load_wh"] = state.dailyEnergy.consumption;
+    energy["battery_in_wh"] = state.dailyEnergy.batteryCharge;
+    energy["battery_out_wh"] = state.dailyEnergy.batteryDischarge;
+    energy["grid_import_wh"] = state.dailyEnergy.gridImport;
+  }
+}
+
+// ===== Status Serializer =====
+// The status payload is serialized once per control tick into a shared
+// buffer. /api/data, the uplink and new event subscribers all send these
+// bytes as-is; `generation` tells consumers whether anything changed.
+struct StatusJson {
+  uint32_t generation;
+  size_t length;
+  char json[STATUS_JSON_SIZE];
+};
+
+SnapshotBuffer<StatusJson> statusJson;
+uint32_t statusGeneration = 0;
+
+// Control loop only: called right after the ControlSnapshot is published
+void publishStatusJson(const ControlSnapshot& state) {
+  StaticJsonDocument<STATE_JSON_CAPACITY> doc;
+  writeStateJson(doc, state, NULL);
+  
+  StatusJson& slot = statusJson.writeSlot();
+  slot.generation = ++statusGeneration;
+  slot.length = serializeJson(doc, slot.json, sizeof(slot.json));
+  statusJson.commit();
+}
+
+// Uplink copy of the status, only touched by the HTTP worker
+StatusJson uplinkStatus;
+
 // ===== Fetch predictions from database API =====
 bool fetchPredictions() {
+  BENCH_SCOPE(BENCH_FETCH_PREDICTIONS);
+  METRIC_SCOPE(METRIC_FETCH_PREDICTIONS);
   if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("WiFi not connected");
+    LOG_WARN("WiFi not connected");
     return false;
   }
-
-  HTTPClient http;
-  String url = String(API_SERVER) + "/api/current_prediction";
   
-  Serial.println("Fetching predictions from: " + url);
-  http.begin(url);
+  LOG_DEBUG("Fetching predictions from: %s", predictionUrl);
+  if (!apiClient.begin(apiSocket, predictionUrl)) return false;
   
-  int httpCode = http.GET();
+  int httpCode = apiClient.GET();
+  bool ok = false;
   
   if (httpCode == 200) {
-    String payload = http.getString();
-    Serial.println("Received: " + payload);
-    
-    // Parse JSON
-    DynamicJsonDocument doc(1024);
-    DeserializationError error = deserializeJson(doc, payload);
-    
-    if (error) {
-      Serial.println("JSON parsing failed");
-      http.end();
-      return false;
-    }
-    
-    // Extract data
-    predictedPvPower = doc["pv_power"] | 0;
-    predictedConsumption = doc["consumption"] | 0;
-    batterySOC = doc["battery_soc"] | 70;
-    
-    Serial.printf("Predicted PV: %.1f W, Consumption: %.1f W, Battery: %.1f%%\n", 
-                  predictedPvPower, predictedConsumption, batterySOC);
-    
-    http.end();
-    return true;
+    ok = parsePrediction(apiClient.getStream(), predictionState);
   } else {
-    Serial.printf("HTTP Error: %d\n", httpCode);
-    http.end();
-    return false;
+    LOG_WARN("HTTP Error: %d", httpCode);
   }
+  
+  apiClient.end();  // Keeps the socket open when the server allows keep-alive
+  return ok;
 }
 
-// ===== Send status to database =====
-void sendStatusToDatabase() {
-  if (WiFi.status() != WL_CONNECTED) return;
+// ===== Fetch 24 h forecast =====
+bool fetchForecast() {
+  METRIC_SCOPE(METRIC_FETCH_FORECAST);
+  if (WiFi.status() != WL_CONNECTED) return false;
+  if (!apiClient.begin(apiSocket, forecastUrl)) return false;
+  
+  int httpCode = apiClient.GET();
+  bool ok = false;
+  
+  if (httpCode == 200) {
+    ok = parseForecast(apiClient.getStream());
+  } else {
+    LOG_WARN("Forecast HTTP Error: %d", httpCode);
+  }
+  
+  apiClient.end();
+  return ok;
+}
+
+// ===== Binary Telemetry =====
+// Fixed little-endian record with a version byte. Device states travel as a
+// bitmask and values as scaled integers; api_server_integrated.py decodes it.
+// Several records may be concatenated in one request body. A record taken
+// before NTP sync holds seconds since boot (TELEMETRY_UPTIME) and the boot
+// it belongs to; rebaseTelemetry() moves it onto Unix time before sending
+// once the clock is known. The server drops records it cannot place.
+// Version 3 widened the device bitmask to every DeviceMask circuit.
+const uint8_t TELEMETRY_VERSION = 3;
+
+enum TelemetryFlags : uint8_t {
+  TELEMETRY_GRID = 0x01,
+  TELEMETRY_WATER_HEATER = 0x02,
+  TELEMETRY_AUTO_MODE = 0x04,
+  TELEMETRY_PREDICTION_STALE = 0x08,
+  TELEMETRY_UPTIME = 0x10       // timestamp is seconds since boot `boot`
+};
+
+struct __attribute__((packed)) TelemetryRecord {
+  uint8_t version;
+  uint8_t flags;          // TelemetryFlags
+  uint8_t boot;           // Boot counter, low byte
+  uint8_t reserved;
+  uint32_t devices;       // Bit i = DEVICE_TABLE[i] on
+  uint32_t timestamp;     // Unix seconds, or seconds since boot with TELEMETRY_UPTIME
+  uint16_t pvPower;       // W
+  uint16_t load;          // W
+  uint16_t batterySOC;    // 0.01 %
+  uint16_t efficiency;    // 0.01 %
+};
+static_assert(sizeof(TelemetryRecord) == 20, "TelemetryRecord layout is part of the wire format");
+
+uint16_t scaleToU16(float value, float scale) {
+  float scaled = value * scale + 0.5f;
+  if (scaled <= 0) return 0;
+  if (scaled >= 65535) return 65535;
+  return (uint16_t)scaled;
+}
+
+uint32_t uptimeSeconds() {
+  return millis() / 1000;
+}
+
+uint8_t bootId = 0;
+
+// Counts boots in NVS, so records from before a reset are told apart
+void initBootId() {
+  Preferences prefs;
+  prefs.begin("ems", false);
+  bootId = prefs.getUChar("boot", 0) + 1;
+  prefs.putUChar("boot", bootId);
+  prefs.end();
+}
+
+// Records from this boot that were taken before the clock was set
+void rebaseTelemetry(TelemetryRecord* records, size_t count) {
+  uint32_t unixNow = unixTime();
+  if (unixNow == 0) return;
+  uint32_t bootedAt = unixNow - uptimeSeconds();
+  for (size_t i = 0; i < count; i++) {
+    if (!(records[i].flags & TELEMETRY_UPTIME) || records[i].boot != bootId) continue;
+    records[i].timestamp += bootedAt;
+    records[i].flags &= ~TELEMETRY_UPTIME;
+  }
+}
+
+void encodeTelemetry(const ControlSnapshot& state, TelemetryRecord& record) {
+  record.version = TELEMETRY_VERSION;
+  record.flags = (state.gridPower ? TELEMETRY_GRID : 0) |
+                 (state.waterHeater ? TELEMETRY_WATER_HEATER : 0) |
+                 (state.autoMode ? TELEMETRY_AUTO_MODE : 0) |
+                 (state.predictionStale ? TELEMETRY_PREDICTION_STALE : 0);
+  record.boot = bootId;
+  record.reserved = 0;
+  record.devices = state.devices;
+  record.timestamp = unixTime();
+  if (record.timestamp == 0) {
+    record.flags |= TELEMETRY_UPTIME;
+    record.timestamp = uptimeSeconds();
+  }
+  record.pvPower = scaleToU16(state.currentPvPower, 1);
+  record.load = scaleToU16(state.totalLoad, 1);
+  record.batterySOC = scaleToU16(state.batterySOC, 100);
+  record.efficiency = scaleToU16(state.systemEfficiency, 100);
+}
 
-  HTTPClient http;
-  String url = String(API_SERVER) + "/api/update_status";
+// Begin a POST of the current status in the configured uplink format.
+// Leaves apiClient open so the caller can read the response.
+int postStatus(const char* url) {
+  if (!apiClient.begin(apiSocket, url)) return HTTPC_ERROR_CONNECTION_REFUSED;
   
-  http.begin(url);
-  http.addHeader("Content-Type", "application/json");
+  apiClient.addHeader("X-Device-Id", deviceId);
+#if EMS_TELEMETRY_BINARY
+  ControlSnapshot state;
+  controlState.read(state);
+  TelemetryRecord record;
+  encodeTelemetry(state, record);
+  apiClient.addHeader("Content-Type", "application/octet-stream");
+  return apiClient.POST((uint8_t*)&record, sizeof(record));
+#else
+  statusJson.read(uplinkStatus);
+  apiClient.addHeader("Content-Type", "application/json");
+  return apiClient.POST((uint8_t*)uplinkStatus.json, uplinkStatus.length);
+#endif
+}
+
+// ===== Send status to database =====
+bool sendStatusToDatabase() {
+  BENCH_SCOPE(BENCH_SEND_STATUS);
+  METRIC_SCOPE(METRIC_SEND_STATUS);
+  if (WiFi.status() != WL_CONNECTED) return false;
   
-  // Create JSON payload
-  DynamicJsonDocument doc(1024);
-  doc["pv_power"] = currentPvPower;
-  doc["consumption"] = totalLoad;
-  doc["battery_soc"] = batterySOC;
-  doc["grid_power"] = gridPower;
-  doc["efficiency"] = systemEfficiency;
+  int httpCode = postStatus(statusUrl);
   
-  JsonArray devicesArray = doc.createNestedArray("devices");
-  for (int i = 0; i < 6; i++) {
-    JsonObject device = devicesArray.createNestedObject();
-    device["name"] = deviceNames[i];
-    device["status"] = devices[i];
-    device["power"] = devices[i] ? deviceLoad[i] : 0;
+  if (httpCode == 200) {
+    LOG_DEBUG("Status updated successfully");
+  } else {
+    LOG_WARN("Status update failed: %d", httpCode);
   }
   
-  String jsonString;
-  serializeJson(doc, jsonString);
+  apiClient.end();
+  return httpCode == 200;
+}
+
+// ===== Push status and pull the next prediction in one round-trip =====
+bool syncWithServer() {
+  BENCH_SCOPE(BENCH_SYNC);
+  METRIC_SCOPE(METRIC_SYNC);
+  if (WiFi.status() != WL_CONNECTED) {
+    LOG_WARN("WiFi not connected");
+    return false;
+  }
   
-  int httpCode = http.POST(jsonString);
+  int httpCode = postStatus(syncUrl);
+  bool ok = false;
   
   if (httpCode == 200) {
-    Serial.println("Status updated successfully");
+    ok = parsePrediction(apiClient.getStream(), predictionState);
   } else {
-    Serial.printf("Status update failed: %d\n", httpCode);
+    LOG_WARN("Sync failed: %d", httpCode);
   }
   
-  http.end();
+  apiClient.end();
+  return ok;
 }
 
-// ===== Calculate system efficiency =====
-float calculateEfficiency() {
-  if (totalLoad == 0) return 100.0;
+// Set by the worker after every status-carrying request
+std::atomic<bool> uplinkHealthy{true};
+
+// ===== Offline Log =====
+// While the uplink is down, one TelemetryRecord per TELEMETRY_INTERVAL is
+// appended to an append-only LittleFS file. Records are batched in RAM and
+// written a flash page at a time to limit wear. Once the uplink is back,
+// the backlog is POSTed to /api/update_status_bin in bulk batches; a cursor
+// file holds the offset of the first unsent record, so every record is
+// sent once. The log, batch and cursor are only touched by the HTTP worker.
+#if EMS_OFFLINE_LOG
+const char* OFFLINE_LOG_PATH = "/telemetry.log";
+const char* OFFLINE_LOG_CURSOR_PATH = "/telemetry.cur";
+const size_t OFFLINE_LOG_PAGE_SIZE = 4096;
+const size_t OFFLINE_LOG_BATCH_RECORDS = OFFLINE_LOG_PAGE_SIZE / sizeof(TelemetryRecord);
+const unsigned long OFFLINE_LOG_MAX_BUFFER_AGE = 1800000;         // Flush a partial page after 30 min
+const size_t OFFLINE_LOG_MAX_BYTES = 64 * OFFLINE_LOG_PAGE_SIZE;  // ~9 days at one record per minute
+const size_t REPLAY_BATCH_RECORDS = 64;                           // 1.25 KB per request
+const int REPLAY_BATCHES_PER_JOB = 4;                             // Keep the worker responsive
+
+bool logReady = false;
+TelemetryRecord logBatch[OFFLINE_LOG_BATCH_RECORDS];
+size_t logBatchCount = 0;
+unsigned long logBatchStartedAt = 0;
+uint32_t logDropped = 0;
+TelemetryRecord replayBatch[REPLAY_BATCH_RECORDS];
+
+void initOfflineLog() {
+  logReady = LittleFS.begin(true);  // Formats on first use
+  if (!logReady) {
+    LOG_ERROR("LittleFS mount failed - offline log disabled");
+    return;
+  }
+  
+  // A log from older firmware has a different record size: it cannot be replayed
+  File file = LittleFS.open(OFFLINE_LOG_PATH, "r");
+  if (!file) return;
+  uint8_t version = 0;
+  file.read(&version, 1);
+  file.close();
+  if (version != TELEMETRY_VERSION) {
+    LOG_WARN("Offline log is telemetry version %u, discarding it", version);
+    LittleFS.remove(OFFLINE_LOG_PATH);
+    LittleFS.remove(OFFLINE_LOG_CURSOR_PATH);
+  }
+}
+
+uint32_t readLogCursor() {
+  File file = LittleFS.open(OFFLINE_LOG_CURSOR_PATH, "r");
+  if (!file) return 0;
+  uint32_t cursor = 0;
+  if (file.read((uint8_t*)&cursor, sizeof(cursor)) != sizeof(cursor)) cursor = 0;
+  file.close();
+  return cursor;
+}
+
+void writeLogCursor(uint32_t cursor) {
+  File file = LittleFS.open(OFFLINE_LOG_CURSOR_PATH, "w");
+  if (!file) return;
+  file.write((const uint8_t*)&cursor, sizeof(cursor));
+  file.close();
+}
+
+void flushLogBatch() {
+  if (!logReady || logBatchCount == 0) return;
+  
+  File file = LittleFS.open(OFFLINE_LOG_PATH, "a");
+  if (!file) return;
+  
+  size_t bytes = logBatchCount * sizeof(TelemetryRecord);
+  if (file.size() + bytes > OFFLINE_LOG_MAX_BYTES) {
+    logDropped += logBatchCount;  // Keep the oldest data, it is the hardest to recover
+    LOG_WARN("Offline log full, dropped %lu records", (unsigned long)logDropped);
+  } else {
+    file.write((const uint8_t*)logBatch, bytes);
+  }
+  file.close();
+  logBatchCount = 0;
+}
+
+void appendLogRecord(const TelemetryRecord& record) {
+  if (!logReady) return;
+  if (logBatchCount == 0) logBatchStartedAt = millis();
+  logBatch[logBatchCount++] = record;
+  
+  if (logBatchCount == OFFLINE_LOG_BATCH_RECORDS || millis() - logBatchStartedAt >= OFFLINE_LOG_MAX_BUFFER_AGE) {
+    flushLogBatch();
+  }
+}
+
+bool hasLogBacklog() {
+  return logReady && (logBatchCount > 0 || LittleFS.exists(OFFLINE_LOG_PATH));
+}
+
+// Send up to REPLAY_BATCHES_PER_JOB batches, oldest first
+void replayOfflineLog() {
+  flushLogBatch();  // Partial page is fine here, it is about to be sent
+  if (!logReady || !LittleFS.exists(OFFLINE_LOG_PATH)) return;
+  
+  for (int batch = 0; batch < REPLAY_BATCHES_PER_JOB; batch++) {
+    if (WiFi.status() != WL_CONNECTED) return;
+    
+    uint32_t cursor = readLogCursor();
+    File file = LittleFS.open(OFFLINE_LOG_PATH, "r");
+    if (!file) return;
+    
+    size_t total = file.size();
+    if (cursor >= total) {
+      // Everything sent: start a fresh log
+      file.close();
+      LittleFS.remove(OFFLINE_LOG_PATH);
+      LittleFS.remove(OFFLINE_LOG_CURSOR_PATH);
+      LOG_INFO("Offline log replay complete");
+      return;
+    }
+    
+    file.seek(cursor);
+    size_t bytes = file.read((uint8_t*)replayBatch, sizeof(replayBatch));
+    file.close();
+    bytes -= bytes % sizeof(TelemetryRecord);
+    if (bytes == 0) return;
+    rebaseTelemetry(replayBatch, bytes / sizeof(TelemetryRecord));
+    
+    if (!apiClient.begin(apiSocket, replayUrl)) return;
+    apiClient.addHeader("X-Device-Id", deviceId);
+    apiClient.addHeader("Content-Type", "application/octet-stream");
+    int httpCode = apiClient.POST((uint8_t*)replayBatch, bytes);
+    apiClient.end();
+    
+    if (httpCode != 200) {
+      LOG_WARN("Offline log replay failed: %d", httpCode);
+      return;
+    }
+    
+    writeLogCursor(cursor + bytes);
+    LOG_INFO("Replayed %u offline records (%lu/%u bytes)",
+                  (unsigned)(bytes / sizeof(TelemetryRecord)),
+                  (unsigned long)(cursor + bytes), (unsigned)total);
+  }
+}
+#endif
+
+// ===== HTTP Worker =====
+// The scheduler only queues jobs; the worker performs the blocking calls and
+// clears the in-flight flag when done. Fetch timing (including backoff) is
+// owned by whichever side currently holds fetchInFlight.
+enum HttpJobType : uint8_t {
+  JOB_FETCH_PREDICTIONS,
+  JOB_SEND_STATUS,
+  JOB_SYNC,
+  JOB_LOG_RECORD,
+  JOB_FETCH_FORECAST,
+  JOB_REPLAY_LOG
+};
+
+struct HttpJob {
+  HttpJobType type;
+  TelemetryRecord record;   // JOB_LOG_RECORD only
+};
+
+QueueHandle_t httpJobs = NULL;
+std::atomic<bool> fetchInFlight{false};
+std::atomic<bool> statusInFlight{false};
+unsigned long nextFetchAt = 0;
+uint8_t fetchFailures = 0;
+std::atomic<bool> forecastInFlight{false};
+unsigned long nextForecastAt = 0;
+std::atomic<bool> replayInFlight{false};
+TaskHandle_t plannerTask = NULL;   // Woken when a new forecast arrives
+
+void scheduleNextFetch(bool success) {
+  if (success) {
+    fetchFailures = 0;
+    nextFetchAt = millis() + API_INTERVAL;
+    return;
+  }
+  
+  if (fetchFailures < 16) fetchFailures++;
+  unsigned long backoff = FETCH_BACKOFF_MIN << min((int)fetchFailures - 1, 6);
+  if (backoff > FETCH_BACKOFF_MAX) backoff = FETCH_BACKOFF_MAX;
+  nextFetchAt = millis() + backoff;
+  LOG_WARN("Prediction fetch failed (%d in a row), retrying in %lu s",
+                fetchFailures, backoff / 1000);
+}
+
+void httpWorkerTask(void* parameter) {
+  HttpJob job;
+  for (;;) {
+    if (xQueueReceive(httpJobs, &job, portMAX_DELAY) != pdTRUE) continue;
+    
+    bool statusSent = false;
+    switch (job.type) {
+      case JOB_FETCH_PREDICTIONS: {
+        bool ok = fetchPredictions();
+        if (!ok) METRIC_FAILURE(METRIC_FETCH_PREDICTIONS);
+        scheduleNextFetch(ok);
+        fetchInFlight.store(false, std::memory_order_release);
+        break;
+      }
+      case JOB_SYNC:
+        statusSent = syncWithServer();
+        if (!statusSent) METRIC_FAILURE(METRIC_SYNC);
+        uplinkHealthy.store(statusSent, std::memory_order_relaxed);
+        scheduleNextFetch(statusSent);
+        fetchInFlight.store(false, std::memory_order_release);
+        break;
+      case JOB_SEND_STATUS:
+        statusSent = sendStatusToDatabase();
+        if (!statusSent) METRIC_FAILURE(METRIC_SEND_STATUS);
+        uplinkHealthy.store(statusSent, std::memory_order_relaxed);
+        statusInFlight.store(false, std::memory_order_release);
+        break;
+      case JOB_LOG_RECORD:
+#if EMS_OFFLINE_LOG
+        appendLogRecord(job.record);
+#endif
+        break;
+      case JOB_FETCH_FORECAST: {
+        bool ok = fetchForecast();
+        if (!ok) METRIC_FAILURE(METRIC_FETCH_FORECAST);
+        nextForecastAt = millis() + (ok ? FORECAST_INTERVAL : FORECAST_RETRY_INTERVAL);
+        forecastInFlight.store(false, std::memory_order_release);
+        if (ok && plannerTask != NULL) xTaskNotifyGive(plannerTask);
+        break;
+      }
+      case JOB_REPLAY_LOG:
+#if EMS_OFFLINE_LOG
+        if (hasLogBacklog()) replayOfflineLog();
+#endif
+        replayInFlight.store(false, std::memory_order_release);
+        break;
+    }
+    
+#if EMS_OFFLINE_LOG
+    // The server is reachable again: drain whatever piled up meanwhile
+    if (statusSent && hasLogBacklog()) {
+      replayOfflineLog();
+    }
+#endif
+  }
+}
+
+// Non-blocking: returns false if the job is already pending or the queue is full
+bool queueHttpJob(HttpJobType type, std::atomic<bool>& inFlight) {
+  if (inFlight.exchange(true, std::memory_order_acq_rel)) return false;
+  HttpJob job;
+  job.type = type;
+  if (xQueueSend(httpJobs, &job, 0) != pdTRUE) {
+    inFlight.store(false, std::memory_order_release);
+    return false;
+  }
+  return true;
+}
+
+void queueLogRecord(const TelemetryRecord& record) {
+  HttpJob job;
+  job.type = JOB_LOG_RECORD;
+  job.record = record;
+  xQueueSend(httpJobs, &job, 0);
+}
+
+// Offline log entry for the current state; only queued while the uplink is down
+void queueOfflineRecord() {
+  if (uplinkHealthy.load(std::memory_order_relaxed)) return;
+  
+  ControlSnapshot state;
+  controlState.read(state);
+  TelemetryRecord record;
+  encodeTelemetry(state, record);
+  queueLogRecord(record);
+}
+
+void startHttpWorker() {
+  initApiClient();
+#if EMS_OFFLINE_LOG
+  initOfflineLog();
+#endif
+  httpJobs = xQueueCreate(8, sizeof(HttpJob));
+  xTaskCreatePinnedToCore(httpWorkerTask, "http", HTTP_WORKER_STACK, NULL,
+                          HTTP_WORKER_PRIORITY, NULL, HTTP_WORKER_CORE);
+}
+
+// ===== MQTT =====
+// Second uplink, next to HTTP. Topics under MQTT_TOPIC_ROOT/<node>:
+//   state       full state JSON, retained, when it changed (at most every 5 s)
+//   samples     one TelemetryRecord per 10 s, batched into one publish a minute
+//   online      "1", or "0" as the last will
+//   prediction  subscribed, same JSON as /api/current_prediction
+// MQTT_TOPIC_ROOT/prediction is subscribed too, for one feed to all nodes.
+// The client lives in its own task and everything else hands it work
+// through a queue without waiting, so a slow broker never holds up control.
+// While the broker is up, HTTP status uploads stop, and so does polling
+// once predictions arrive over MQTT.
+#if EMS_MQTT
+const char* MQTT_BROKER = "192.168.1.100";        // Change to your broker
+const uint16_t MQTT_PORT = 1883;
+const char* MQTT_TOPIC_ROOT = "ems";
+const unsigned long MQTT_STATE_INTERVAL = 5000;
+const unsigned long MQTT_SAMPLE_INTERVAL = 10000;
+const int MQTT_BATCH_RECORDS = TELEMETRY_INTERVAL / MQTT_SAMPLE_INTERVAL;
+const unsigned long MQTT_LOOP_INTERVAL = 50;      // Max wait for a job between client polls
+const unsigned long MQTT_RETRY_MIN = 2000;
+const unsigned long MQTT_RETRY_MAX = 60000;
+const uint16_t MQTT_SOCKET_TIMEOUT = 2;           // s, bounds a blocking read
+const uint16_t MQTT_KEEPALIVE = 15;               // s
+
+enum MqttJobType : uint8_t {
+  MQTT_JOB_STATE,
+  MQTT_JOB_SAMPLE
+};
+
+struct MqttJob {
+  MqttJobType type;
+  TelemetryRecord record;   // MQTT_JOB_SAMPLE only
+};
+
+QueueHandle_t mqttOutbox = NULL;
+std::atomic<bool> mqttConnected{false};
+std::atomic<unsigned long> mqttPredictionAt{0};
+SnapshotBuffer<PredictionInput> mqttPredictionState;   // Written by the MQTT task
+
+// MQTT task only
+WiFiClient mqttSocket;
+PubSubClient mqttClient(mqttSocket);
+char mqttClientId[16];
+char mqttStateTopic[48];
+char mqttSamplesTopic[48];
+char mqttOnlineTopic[48];
+char mqttPredictionTopic[48];
+char mqttSharedPredictionTopic[48];
+StatusJson mqttStatus;
+uint32_t mqttStateGeneration = 0;
+TelemetryRecord mqttBatch[MQTT_BATCH_RECORDS];
+int mqttBatchCount = 0;
+unsigned long mqttRetry = MQTT_RETRY_MIN;
+unsigned long nextMqttConnectAt = 0;
+
+// Lets parsePrediction() read an MQTT payload like an HTTP body
+class PayloadStream : public Stream {
+ public:
+  PayloadStream(const uint8_t* data, size_t length) : data(data), length(length) {}
+
+  int available() override { return length - position; }
+  int read() override { return position < length ? data[position++] : -1; }
+  int peek() override { return position < length ? data[position] : -1; }
+  size_t write(uint8_t c) override { return 0; }
+
+ private:
+  const uint8_t* data;
+  size_t length;
+  size_t position = 0;
+};
+
+// Called from mqttClient.loop(), in the MQTT task
+void onMqttMessage(char* topic, uint8_t* payload, unsigned int length) {
+  PayloadStream body(payload, length);
+  if (parsePrediction(body, mqttPredictionState)) {
+    mqttPredictionAt.store(millis(), std::memory_order_relaxed);
+  }
+}
+
+bool connectMqtt() {
+  if (!mqttClient.connect(mqttClientId, NULL, NULL, mqttOnlineTopic, 1, true, "0")) return false;
+  
+  mqttClient.publish(mqttOnlineTopic, "1", true);
+  mqttClient.subscribe(mqttPredictionTopic, 1);
+  mqttClient.subscribe(mqttSharedPredictionTopic, 1);
+  mqttStateGeneration = 0;    // A new session gets the state again
+  return true;
+}
+
+void publishMqttState() {
+  statusJson.read(mqttStatus);
+  if (mqttStatus.generation == mqttStateGeneration) return;
+  if (mqttClient.publish(mqttStateTopic, (const uint8_t*)mqttStatus.json, mqttStatus.length, true)) {
+    mqttStateGeneration = mqttStatus.generation;
+  }
+}
+
+void batchMqttSample(const TelemetryRecord& record) {
+  mqttBatch[mqttBatchCount++] = record;
+  if (mqttBatchCount < MQTT_BATCH_RECORDS) return;
+  
+  rebaseTelemetry(mqttBatch, mqttBatchCount);
+  if (mqttClient.publish(mqttSamplesTopic, (const uint8_t*)mqttBatch, mqttBatchCount * sizeof(TelemetryRecord), false)) {
+    uplinkHealthy.store(true, std::memory_order_relaxed);
+#if EMS_OFFLINE_LOG
+    // HTTP status is off while MQTT carries it, so drain the backlog from here
+    queueHttpJob(JOB_REPLAY_LOG, replayInFlight);
+#endif
+  } else {
+    // Log the batch's newest record (the log keeps one per TELEMETRY_INTERVAL)
+    // and the offline log picks up from the next tick
+    LOG_WARN("MQTT sample publish failed (%d)", mqttClient.state());
+    uplinkHealthy.store(false, std::memory_order_relaxed);
+#if EMS_OFFLINE_LOG
+    queueLogRecord(mqttBatch[mqttBatchCount - 1]);
+#endif
+  }
+  mqttBatchCount = 0;
+}
+
+void mqttTaskLoop(void* parameter) {
+  MqttJob job;
+  for (;;) {
+    if (!mqttClient.connected()) {
+      mqttConnected.store(false, std::memory_order_relaxed);
+      if (WiFi.status() == WL_CONNECTED && (long)(millis() - nextMqttConnectAt) >= 0) {
+        if (connectMqtt()) {
+          LOG_INFO("MQTT connected");
+          mqttRetry = MQTT_RETRY_MIN;
+          mqttConnected.store(true, std::memory_order_relaxed);
+        } else {
+          LOG_WARN("MQTT connect failed (%d), retrying in %lu s", mqttClient.state(), mqttRetry / 1000);
+          nextMqttConnectAt = millis() + mqttRetry;
+          mqttRetry = min(mqttRetry * 2, MQTT_RETRY_MAX);
+        }
+      }
+    }
+    
+    // Jobs that arrive while disconnected are dropped
+    if (xQueueReceive(mqttOutbox, &job, pdMS_TO_TICKS(MQTT_LOOP_INTERVAL)) == pdTRUE && mqttClient.connected()) {
+      switch (job.type) {
+        case MQTT_JOB_STATE:
+          publishMqttState();
+          break;
+        case MQTT_JOB_SAMPLE:
+          batchMqttSample(job.record);
+          break;
+      }
+    }
+    mqttClient.loop();
+  }
+}
+
+void startMqtt() {
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  char node[8];
+  snprintf(node, sizeof(node), "%02x%02x%02x", mac[3], mac[4], mac[5]);
+  snprintf(mqttClientId, sizeof(mqttClientId), "ems-%s", node);
+  snprintf(mqttStateTopic, sizeof(mqttStateTopic), "%s/%s/state", MQTT_TOPIC_ROOT, node);
+  snprintf(mqttSamplesTopic, sizeof(mqttSamplesTopic), "%s/%s/samples", MQTT_TOPIC_ROOT, node);
+  snprintf(mqttOnlineTopic, sizeof(mqttOnlineTopic), "%s/%s/online", MQTT_TOPIC_ROOT, node);
+  snprintf(mqttPredictionTopic, sizeof(mqttPredictionTopic), "%s/%s/prediction", MQTT_TOPIC_ROOT, node);
+  snprintf(mqttSharedPredictionTopic, sizeof(mqttSharedPredictionTopic), "%s/prediction", MQTT_TOPIC_ROOT);
+  
+  mqttClient.setServer(MQTT_BROKER, MQTT_PORT);
+  mqttClient.setCallback(onMqttMessage);
+  mqttClient.setBufferSize(STATUS_JSON_SIZE + 64);   // Default 256 B is too small for the state
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+  mqttClient.setKeepAlive(MQTT_KEEPALIVE);
+  
+  mqttOutbox = xQueueCreate(8, sizeof(MqttJob));
+  xTaskCreatePinnedToCore(mqttTaskLoop, "mqtt", MQTT_STACK, NULL,
+                          MQTT_PRIORITY, NULL, MQTT_CORE);
+  LOG_INFO("MQTT: %s as %s", MQTT_BROKER, mqttClientId);
+}
+
+bool mqttCarriesPredictions() {
+  unsigned long at = mqttPredictionAt.load(std::memory_order_relaxed);
+  return mqttConnected.load(std::memory_order_relaxed) && at != 0 && millis() - at <= PREDICTION_MAX_AGE;
+}
+#endif
+
+// ===== Relay Switching =====
+// Control logic only sets deviceRequest/waterHeaterRequest; updateRelays()
+// decides what actually switches. Each relay channel (the devices, then the
+// water heater) is a two-state machine that leaves ON only after minOnTime
+// and OFF only after minOffTime, and switch-ons are staggered so at most one
+// load starts per RELAY_STAGGER. Switch-offs are never staggered, and
+// forced ones (load shedding) skip the dwell as well.
+typedef uint32_t RelayMask;                    // Device bits + WATER_HEATER_BIT
+const int RELAY_CHANNELS = DEVICE_COUNT + 1;
+constexpr RelayMask WATER_HEATER_BIT = (RelayMask)1 << DEVICE_COUNT;
+const unsigned long RELAY_STAGGER = 1500;      // At most one switch-on per control tick
+
+// Control loop only
+unsigned long relayChangedAt[RELAY_CHANNELS];
+uint16_t switchesToday[RELAY_CHANNELS];
+unsigned long lastSwitchOnAt = 0;
+RelayMask forcedOff = 0;                       // Cleared by every updateRelays()
+bool shedActive = false;
+
+// Hysteresis bands: a load is switched on at the outer threshold and only
+// released at the inner one, so a value hovering on a line does not chatter
+const float HEATER_ON_SURPLUS = 0.8;           // x waterHeaterLoad
+const float HEATER_OFF_SURPLUS = 0.5;
+const int HEATER_ON_SOC = 95;
+const int HEATER_OFF_SOC = 90;
+const int SHED_ENTER_SOC = 10;
+const int SHED_EXIT_SOC = 15;
+
+const DeviceDescriptor& relayDescriptor(int channel) {
+  return channel == DEVICE_COUNT ? WATER_HEATER : DEVICE_TABLE[channel];
+}
+
+void countSwitch(int channel) {
+  if (switchesToday[channel] < 65535) switchesToday[channel]++;
+  countRelaySwitch(channel);
+}
+
+void resetSwitchCounters() {
+  memset(switchesToday, 0, sizeof(switchesToday));
+}
+
+// Turn off non-essential loads now, dwell or not
+void shedLoads() {
+  deviceRequest &= ~SHEDDABLE_DEVICES;
+  waterHeaterRequest = false;
+  forcedOff |= SHEDDABLE_DEVICES | WATER_HEATER_BIT;
+}
+
+// ===== Emergency Trips =====
+// Grid loss, overcurrent and the watchdog open the sheddable relays and the
+// water heater straight from their interrupt or timer with one write to the
+// GPIO clear register, without waiting for the control tick or touching the
+// network stack. They only set a flag for the control loop, which takes the
+// relays' new state over on its next tick (the dwell times start from the
+// trip) and keeps them shed while an overcurrent lasts and for
+// OVERCURRENT_HOLD after it clears. After a grid loss the dispatcher brings
+// loads back as the battery and PV allow.
+enum EmergencyTrip : uint32_t {
+  TRIP_GRID_LOST = 0x01,
+  TRIP_OVERCURRENT = 0x02,
+  TRIP_WATCHDOG = 0x04
+};
+constexpr uint32_t TRIP_GPIO_MASK = relayGpioBits(SHEDDABLE_DEVICES) | (1UL << WATER_HEATER.pin);
+
+std::atomic<uint32_t> emergencyTrips{0};       // Set by ISRs and the watchdog, cleared by control
+
+#if EMS_FAST_PATH
+const uint8_t GRID_SENSE_PIN = 25;             // High while the grid is up (internal pull-down)
+const uint8_t OVERCURRENT_PIN = 26;            // Comparator output, low on overcurrent (internal pull-up)
+static_assert(!(RELAY_GPIO_MASK & ((1UL << GRID_SENSE_PIN) | (1UL << OVERCURRENT_PIN))),
+              "Fast-path inputs must not be relay pins");
+const unsigned long OVERCURRENT_HOLD = 30000;
+#endif
+
+// Control loop only
+bool gridAvailable = true;
+unsigned long overcurrentAt = 0;
+bool overcurrentHold = false;
+
+void IRAM_ATTR tripRelays(uint32_t reason) {
+  REG_WRITE(GPIO_OUT_W1TC_REG, TRIP_GPIO_MASK);
+  emergencyTrips.fetch_or(reason, std::memory_order_relaxed);
+}
+
+#if EMS_FAST_PATH
+void IRAM_ATTR onGridLost() {
+  tripRelays(TRIP_GRID_LOST);
+}
+
+void IRAM_ATTR onOvercurrent() {
+  tripRelays(TRIP_OVERCURRENT);
+}
+
+void startFastPath() {
+  pinMode(GRID_SENSE_PIN, INPUT_PULLDOWN);
+  pinMode(OVERCURRENT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(GRID_SENSE_PIN), onGridLost, FALLING);
+  attachInterrupt(digitalPinToInterrupt(OVERCURRENT_PIN), onOvercurrent, FALLING);
+  // An edge before the interrupts were attached would be missed
+  if (digitalRead(GRID_SENSE_PIN) == LOW) tripRelays(TRIP_GRID_LOST);
+  if (digitalRead(OVERCURRENT_PIN) == LOW) tripRelays(TRIP_OVERCURRENT);
+  LOG_INFO("Fast path armed");
+}
+#endif
+
+// Start of every control tick: take over tripped relays, poll the sense inputs
+void handleTrips() {
+  uint32_t trips = emergencyTrips.exchange(0, std::memory_order_relaxed);
+  unsigned long now = millis();
+  if (trips) {
+    RelayMask actual = deviceState | (waterHeater ? WATER_HEATER_BIT : 0);
+    RelayMask opened = actual & (SHEDDABLE_DEVICES | WATER_HEATER_BIT);
+    for (int channel = 0; channel < RELAY_CHANNELS; channel++) {
+      if (!(opened & ((RelayMask)1 << channel))) continue;
+      relayChangedAt[channel] = now;
+      countSwitch(channel);
+    }
+    deviceState &= ~SHEDDABLE_DEVICES;
+    waterHeater = false;
+    countTrips(trips);
+    LOG_ERROR("CRITICAL: Relays tripped:%s%s%s", trips & TRIP_GRID_LOST ? " grid lost" : "",
+                  trips & TRIP_OVERCURRENT ? " overcurrent" : "", trips & TRIP_WATCHDOG ? " watchdog" : "");
+  }
+  
+#if EMS_FAST_PATH
+  bool wasAvailable = gridAvailable;
+  gridAvailable = digitalRead(GRID_SENSE_PIN) == HIGH;
+  if (gridAvailable && !wasAvailable) LOG_INFO("Grid restored");
+  if (!gridAvailable && wasAvailable) LOG_WARN("Grid lost - islanded");
+  
+  if ((trips & TRIP_OVERCURRENT) || digitalRead(OVERCURRENT_PIN) == LOW) {
+    overcurrentAt = now;
+    overcurrentHold = true;
+  } else if (overcurrentHold && now - overcurrentAt >= OVERCURRENT_HOLD) {
+    overcurrentHold = false;
+    LOG_INFO("Overcurrent cleared");
+  }
+#endif
+}
+
+// ===== Control Watchdog =====
+// An esp_timer callback checks that controlTick() ran within
+// WATCHDOG_TIMEOUT. If not it trips the relays (critical circuits stay as
+// they are) and keeps them tripped; after WATCHDOG_RESTART it restarts
+// the chip, which boots with every relay off. It runs in the esp_timer
+// task, so a stuck control or network task cannot hold it up. The restart
+// never waits on the console: the reason goes to RTC memory, which
+// survives it, and is logged on the next boot.
+#if EMS_WATCHDOG
+const uint32_t WATCHDOG_TIMEOUT = 3 * CONTROL_INTERVAL;
+const uint32_t WATCHDOG_RESTART = 60000;
+const uint64_t WATCHDOG_PERIOD_US = 500000;
+const uint32_t WATCHDOG_RESTART_MAGIC = 0x57444f47;   // "WDOG"
+
+std::atomic<uint32_t> controlFedAt{0};         // millis() of the last tick, 0 until the first
+
+struct WatchdogRestart {
+  uint32_t magic;       // WATCHDOG_RESTART_MAGIC when the watchdog restarted the chip
+  uint32_t starved;     // ms without a control tick
+};
+RTC_NOINIT_ATTR WatchdogRestart watchdogRestart;
+
+void feedWatchdog() {
+  uint32_t now = millis();
+  controlFedAt.store(now ? now : 1, std::memory_order_relaxed);
+}
+
+void watchdogCheck(void* arg) {
+  uint32_t fedAt = controlFedAt.load(std::memory_order_relaxed);
+  if (fedAt == 0) return;                      // Armed by the first tick
+  uint32_t starved = millis() - fedAt;
+  if (starved >= WATCHDOG_RESTART) {
+    watchdogRestart.starved = starved;
+    watchdogRestart.magic = WATCHDOG_RESTART_MAGIC;
+    esp_restart();
+  }
+  if (starved >= WATCHDOG_TIMEOUT) {
+    if (!(emergencyTrips.load(std::memory_order_relaxed) & TRIP_WATCHDOG)) {
+      LOG_ERROR("CRITICAL: No control tick for %lu ms - relays tripped", (unsigned long)starved);
+    }
+    tripRelays(TRIP_WATCHDOG);
+  }
+}
+
+void startWatchdog() {
+  // RTC memory holds garbage after power-on, so only trust it on a software reset
+  if (watchdogRestart.magic == WATCHDOG_RESTART_MAGIC && esp_reset_reason() == ESP_RST_SW) {
+    LOG_ERROR("CRITICAL: Restarted by the watchdog, control loop stuck for %lu ms",
+              (unsigned long)watchdogRestart.starved);
+  }
+  watchdogRestart.magic = 0;
+  
+  esp_timer_create_args_t args = {};
+  args.callback = watchdogCheck;
+  args.name = "watchdog";
+  esp_timer_handle_t timer;
+  if (esp_timer_create(&args, &timer) != ESP_OK || esp_timer_start_periodic(timer, WATCHDOG_PERIOD_US) != ESP_OK) {
+    LOG_ERROR("Watchdog timer failed to start");
+  }
+}
+#endif
+
+// ===== Update relay outputs =====
+// All relays change in one pair of writes to the GPIO set/clear registers
+void updateRelays() {
+  RelayMask requested = deviceRequest | (waterHeaterRequest ? WATER_HEATER_BIT : 0);
+  RelayMask actual = deviceState | (waterHeater ? WATER_HEATER_BIT : 0);
+  RelayMask changed = requested ^ actual;
+  unsigned long now = millis();
+  
+  for (int channel = 0; channel < RELAY_CHANNELS && changed; channel++) {
+    RelayMask bit = (RelayMask)1 << channel;
+    if (!(changed & bit)) continue;
+    
+    const DeviceDescriptor& device = relayDescriptor(channel);
+    bool turningOn = requested & bit;
+    bool forced = !turningOn && (forcedOff & bit);
+    unsigned long dwell = (turningOn ? device.minOffTime : device.minOnTime) * 1000UL;
+    
+    if (!forced && now - relayChangedAt[channel] < dwell) continue;
+    if (turningOn) {
+      if (now - lastSwitchOnAt < RELAY_STAGGER) continue;
+      lastSwitchOnAt = now;
+    }
+    
+    actual ^= bit;
+    relayChangedAt[channel] = now;
+    countSwitch(channel);
+  }
+  
+  deviceState = actual & ALL_DEVICES;
+  waterHeater = actual & WATER_HEATER_BIT;
+  forcedOff = 0;
+  
+  uint32_t high = relayGpioBits(deviceState) | (waterHeater ? 1UL << WATER_HEATER.pin : 0);
+  REG_WRITE(GPIO_OUT_W1TS_REG, high);
+  REG_WRITE(GPIO_OUT_W1TC_REG, RELAY_GPIO_MASK & ~high);
+  // A trip that landed during this tick must not be switched back on
+  if (emergencyTrips.load(std::memory_order_relaxed)) REG_WRITE(GPIO_OUT_W1TC_REG, TRIP_GPIO_MASK);
+}
+
+// ===== Power Budget =====
+// What flexible loads may draw from: PV, the battery while it is above
+// BATTERY_DISPATCH_SOC, and grid import up to DISPATCH_GRID_CAP. The local
+// dispatcher also holds the measured import (load - PV - battery, from the
+// last manageEnergy()) under PEAK_IMPORT_LIMIT, a demand-charge ceiling.
+// The defaults keep comfort loads on PV and battery only.
+const int BATTERY_DISPATCH_SOC = 30;           // %
+const int32_t DISPATCH_GRID_CAP = 0;           // W of grid import flexible loads may use
+const int32_t PEAK_IMPORT_LIMIT = 5000;        // W
+
+// Control loop only
+int32_t gridImportW = 0;                       // Measured by the last manageEnergy()
+
+constexpr int32_t supplyPower(int32_t pvPower, bool batteryAvailable, bool grid = true) {
+  return pvPower + (batteryAvailable ? (int32_t)maxBatteryPower : 0) + (grid ? DISPATCH_GRID_CAP : 0);
+}
+
+// ===== Fleet =====
+// Units on one PV array and battery would otherwise each run the battery
+// decision for the whole house. Every node broadcasts its load over ESP-NOW
+// every FLEET_INTERVAL; the node with the lowest id heard recently is the
+// coordinator. It alone runs manageEnergy() (for the fleet's summed load)
+// and broadcasts one budget per node, plus SOC, grid and shedding state.
+// Followers switch loads within their budget and fall back to local
+// control when budgets stop arriving. Election is implicit, so a new or
+// dead coordinator is settled within one peer timeout.
+#if EMS_FLEET
+const unsigned long FLEET_INTERVAL = 250;          // Status and budget frames
+const unsigned long FLEET_PEER_TIMEOUT = 1000;     // Peer dropped after ~4 missed frames
+const unsigned long FLEET_BUDGET_TIMEOUT = 1000;   // Follower goes back to local control
+const int FLEET_MAX_NODES = 32;                    // This node included
+const int FLEET_MAX_PEERS = FLEET_MAX_NODES - 1;
+const uint8_t FLEET_VERSION = 1;
+
+enum FleetFrameType : uint8_t {
+  FLEET_STATUS = 1,
+  FLEET_BUDGET = 2
+};
+
+enum FleetFlags : uint8_t {
+  FLEET_GRID = 0x01,
+  FLEET_SHED = 0x02
+};
+
+struct __attribute__((packed)) FleetStatusFrame {
+  uint8_t version;
+  uint8_t type;           // FLEET_STATUS
+  uint32_t nodeId;
+  uint16_t loadW;         // Switched on now
+  uint16_t pendingW;      // Sheddable loads and water heater still off
+};
+
+struct __attribute__((packed)) FleetBudgetEntry {
+  uint32_t nodeId;
+  uint16_t budgetW;
+};
+
+struct __attribute__((packed)) FleetBudgetFrame {
+  uint8_t version;
+  uint8_t type;           // FLEET_BUDGET
+  uint32_t nodeId;        // Coordinator
+  uint8_t flags;          // FleetFlags
+  uint8_t count;
+  uint16_t pvW;
+  uint16_t batterySOC;    // % x 100
+  FleetBudgetEntry entries[FLEET_MAX_NODES];
+};
+
+static_assert(sizeof(FleetBudgetFrame) <= ESP_NOW_MAX_DATA_LEN, "Budgets must fit one ESP-NOW frame");
+
+enum FleetRole : uint8_t {
+  FLEET_LOCAL,            // Alone, or no budget: plain manageEnergy()
+  FLEET_COORDINATOR,
+  FLEET_FOLLOWER
+};
+
+// Published by the fleet task, read by the control loop every tick
+struct FleetView {
+  FleetRole role;
+  float budget;           // W this node may draw
+  float peerLoad;         // Coordinator only: load of the other nodes
+  float pvPower;          // Follower only: the coordinator's view
+  float batterySOC;
+  bool gridPower;
+  bool shed;
+  unsigned long updatedAt;
+};
+
+struct FleetMessage {
+  uint8_t length;
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+};
+
+struct FleetPeer {
+  uint32_t nodeId;
+  uint16_t loadW;
+  uint16_t pendingW;
+  unsigned long heardAt;
+};
+
+const uint8_t FLEET_BROADCAST[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+SnapshotBuffer<FleetView> fleetState;
+std::atomic<bool> fleetFollowing{false};   // Read by the scheduler
+QueueHandle_t fleetInbox = NULL;
+
+// Fleet task only
+uint32_t fleetNodeId = 0;
+FleetPeer fleetPeers[FLEET_MAX_PEERS];
+int fleetPeerCount = 0;
+unsigned long lastBudgetAt = 0;
+
+// Runs in the WiFi task: copy the frame out and return
+#if ESP_IDF_VERSION_MAJOR >= 5
+void onFleetReceive(const esp_now_recv_info_t* info, const uint8_t* data, int length) {
+#else
+void onFleetReceive(const uint8_t* mac, const uint8_t* data, int length) {
+#endif
+  if (length <= 0 || length > ESP_NOW_MAX_DATA_LEN) return;
+  FleetMessage message;
+  message.length = length;
+  memcpy(message.data, data, length);
+  xQueueSend(fleetInbox, &message, 0);
+}
+
+uint32_t fleetCoordinator() {
+  uint32_t lowest = fleetNodeId;
+  for (int i = 0; i < fleetPeerCount; i++) {
+    lowest = min(lowest, fleetPeers[i].nodeId);
+  }
+  return lowest;
+}
+
+void recordFleetPeer(const FleetStatusFrame& frame) {
+  if (frame.nodeId == fleetNodeId) return;
+  int slot = 0;
+  while (slot < fleetPeerCount && fleetPeers[slot].nodeId != frame.nodeId) slot++;
+  if (slot == fleetPeerCount) {
+    if (fleetPeerCount == FLEET_MAX_PEERS) return;   // Own entry takes the last budget slot
+    fleetPeerCount++;
+  }
+  fleetPeers[slot] = {frame.nodeId, frame.loadW, frame.pendingW, millis()};
+}
+
+void followFleetBudget(const FleetBudgetFrame& frame) {
+  if (frame.nodeId != fleetCoordinator() || frame.nodeId == fleetNodeId) return;
+  
+  for (int i = 0; i < frame.count; i++) {
+    if (frame.entries[i].nodeId != fleetNodeId) continue;
+    
+    lastBudgetAt = millis();
+    FleetView& view = fleetState.writeSlot();
+    view.role = FLEET_FOLLOWER;
+    view.budget = frame.entries[i].budgetW;
+    view.peerLoad = 0;
+    view.pvPower = frame.pvW;
+    view.batterySOC = frame.batterySOC / 100.0;
+    view.gridPower = frame.flags & FLEET_GRID;
+    view.shed = frame.flags & FLEET_SHED;
+    view.updatedAt = lastBudgetAt;
+    fleetState.commit();
+    return;
+  }
+}
+
+void handleFleetMessage(const FleetMessage& message) {
+  if (message.length < 2 || message.data[0] != FLEET_VERSION) return;
+  
+  if (message.data[1] == FLEET_STATUS && message.length == sizeof(FleetStatusFrame)) {
+    FleetStatusFrame frame;
+    memcpy(&frame, message.data, sizeof(frame));
+    recordFleetPeer(frame);
+  } else if (message.data[1] == FLEET_BUDGET && message.length >= offsetof(FleetBudgetFrame, entries)) {
+    FleetBudgetFrame frame = {};
+    size_t length = min((size_t)message.length, sizeof(frame));
+    memcpy(&frame, message.data, length);
+    frame.count = min((size_t)frame.count, (length - offsetof(FleetBudgetFrame, entries)) / sizeof(FleetBudgetEntry));
+    followFleetBudget(frame);
+  }
+}
+
+// Every node gets what it draws now. Spare power is shared out in
+// proportion to the loads each node still has waiting; a shortfall is cut
+// in proportion to load. Available power is the same supplyPower() local
+// dispatch uses.
+void coordinateFleet(const ControlSnapshot& state, uint16_t ownLoad, uint16_t ownPending) {
+  float available = supplyPower(lroundf(state.currentPvPower), state.batterySOC > BATTERY_DISPATCH_SOC);
+  float fleetLoad = ownLoad;
+  float fleetPending = ownPending;
+  for (int i = 0; i < fleetPeerCount; i++) {
+    fleetLoad += fleetPeers[i].loadW;
+    fleetPending += fleetPeers[i].pendingW;
+  }
+  float spare = available - fleetLoad;
+  int nodes = fleetPeerCount + 1;
+  
+  FleetBudgetFrame frame;
+  frame.version = FLEET_VERSION;
+  frame.type = FLEET_BUDGET;
+  frame.nodeId = fleetNodeId;
+  frame.flags = (state.gridPower ? FLEET_GRID : 0) | (state.loadShedding ? FLEET_SHED : 0);
+  frame.count = nodes;
+  frame.pvW = (uint16_t)constrain(state.currentPvPower, 0.0f, 65535.0f);
+  frame.batterySOC = (uint16_t)lroundf(state.batterySOC * 100);
+  
+  float ownBudget = 0;
+  for (int i = 0; i < nodes; i++) {
+    uint32_t nodeId = i == 0 ? fleetNodeId : fleetPeers[i - 1].nodeId;
+    float load = i == 0 ? ownLoad : fleetPeers[i - 1].loadW;
+    float pending = i == 0 ? ownPending : fleetPeers[i - 1].pendingW;
+    
+    float budget;
+    if (spare < 0) {
+      budget = fleetLoad > 0 ? load * available / fleetLoad : 0;
+    } else {
+      budget = load + spare * (fleetPending > 0 ? pending / fleetPending : 1.0f / nodes);
+    }
+    if (i == 0) ownBudget = budget;
+    frame.entries[i] = {nodeId, (uint16_t)constrain(budget, 0.0f, 65535.0f)};
+  }
+  
+  esp_now_send(FLEET_BROADCAST, (const uint8_t*)&frame,
+               offsetof(FleetBudgetFrame, entries) + nodes * sizeof(FleetBudgetEntry));
+  
+  FleetView& view = fleetState.writeSlot();
+  view.role = FLEET_COORDINATOR;
+  view.budget = ownBudget;
+  view.peerLoad = fleetLoad - ownLoad;
+  view.pvPower = state.currentPvPower;
+  view.batterySOC = state.batterySOC;
+  view.gridPower = state.gridPower;
+  view.shed = state.loadShedding;
+  view.updatedAt = millis();
+  fleetState.commit();
+}
+
+void publishLocalFleetView() {
+  FleetView& view = fleetState.writeSlot();
+  view = {};
+  view.role = FLEET_LOCAL;
+  view.updatedAt = millis();
+  fleetState.commit();
+}
+
+void fleetRound() {
+  unsigned long now = millis();
+  for (int i = 0; i < fleetPeerCount;) {
+    if (now - fleetPeers[i].heardAt > FLEET_PEER_TIMEOUT) {
+      fleetPeers[i] = fleetPeers[--fleetPeerCount];
+    } else {
+      i++;
+    }
+  }
+  
+  ControlSnapshot state;
+  controlState.read(state);
+  DeviceMask waiting = SHEDDABLE_DEVICES & ~state.devices;
+  
+  FleetStatusFrame status;
+  status.version = FLEET_VERSION;
+  status.type = FLEET_STATUS;
+  status.nodeId = fleetNodeId;
+  status.loadW = scaleToU16(ratedLoad(state.devices) + (state.waterHeater ? waterHeaterLoad : 0), 1);
+  status.pendingW = scaleToU16(ratedLoad(waiting) + (state.waterHeater ? 0 : waterHeaterLoad), 1);
+  esp_now_send(FLEET_BROADCAST, (const uint8_t*)&status, sizeof(status));
+  
+  bool coordinator = fleetCoordinator() == fleetNodeId;
+  if (coordinator && fleetPeerCount > 0) {
+    coordinateFleet(state, status.loadW, status.pendingW);
+  } else if (coordinator || now - lastBudgetAt > FLEET_BUDGET_TIMEOUT) {
+    publishLocalFleetView();
+  }
+  fleetFollowing.store(!coordinator && now - lastBudgetAt <= FLEET_BUDGET_TIMEOUT, std::memory_order_relaxed);
+}
+
+void fleetTaskLoop(void* parameter) {
+  FleetMessage message;
+  unsigned long nextRoundAt = millis();
+  for (;;) {
+    long wait = (long)(nextRoundAt - millis());
+    if (wait > 0) {
+      if (xQueueReceive(fleetInbox, &message, pdMS_TO_TICKS(wait)) == pdTRUE) handleFleetMessage(message);
+      continue;
+    }
+    nextRoundAt += FLEET_INTERVAL;
+    fleetRound();
+  }
+}
+
+// Right after startWifi() has put the radio in station mode, before the
+// link is up. The broadcast peer has channel 0, so ESP-NOW follows the
+// station's channel: the cached one (or the scan's) while joining, then
+// the AP's
+void startFleet() {
+  uint8_t mac[6];
+  esp_wifi_get_mac(WIFI_IF_STA, mac);
+  fleetNodeId = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+  publishLocalFleetView();
+  
+  fleetInbox = xQueueCreate(8, sizeof(FleetMessage));
+  if (esp_now_init() != ESP_OK) {
+    LOG_ERROR("Fleet: ESP-NOW init failed, running standalone");
+    return;
+  }
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, FLEET_BROADCAST, sizeof(FLEET_BROADCAST));
+  peer.ifidx = WIFI_IF_STA;
+  peer.encrypt = false;
+  esp_now_add_peer(&peer);
+  esp_now_register_recv_cb(onFleetReceive);
+  
+  xTaskCreatePinnedToCore(fleetTaskLoop, "fleet", FLEET_STACK, NULL,
+                          FLEET_PRIORITY, NULL, FLEET_CORE);
+  LOG_INFO("Fleet: node %08lx", (unsigned long)fleetNodeId);
+}
+#endif
+
+// ===== On-Device Model =====
+// Linear PV and load model fitted and quantized by export_tiny_model.py.
+// PV is the clear-sky value for the hour and day of year (sine of the sun's
+// elevation times TINY_PV_NORM), scaled by the clearness last observed;
+// load follows the hourly profile and the last observed load. Observations
+// come from fresh predictions or the meters and fade back to the trained
+// defaults over TINY_MODEL_MEMORY. The control loop owns all of it.
+#if EMS_TINY_MODEL
+const unsigned long TINY_MODEL_MEMORY = 6 * 3600000UL;
+const float TINY_MIN_SUN = 0.1;            // Clearness is not observable below this
+constexpr float TINY_WEIGHT_SCALE = 1.0f / (1 << TINY_WEIGHT_SHIFT);
+constexpr float TINY_DEGREE = (float)DEG_TO_RAD;   // Single precision: the FPU has no doubles
+
+struct TinyObservation {
+  float clearness;
+  unsigned long clearnessAt;    // 0 = never
+  float load;
+  unsigned long loadAt;
+};
+
+TinyObservation tinyObservation = {};
+
+struct TinyClock {
+  float hour;                   // Local, fractional
+  float solarHour;              // Local standard time: daylight saving taken out
+  int dayOfYear;
+  bool weekend;
+};
+
+bool readTinyClock(TinyClock& clock) {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) return false;   // Never wait in the control loop
+  clock.hour = timeinfo.tm_hour + timeinfo.tm_min / 60.0f;
+  clock.solarHour = clock.hour - (timeinfo.tm_isdst > 0 ? 1 : 0);
+  clock.dayOfYear = timeinfo.tm_yday + 1;
+  clock.weekend = timeinfo.tm_wday == 0 || timeinfo.tm_wday == 6;
+  return true;
+}
+
+// Same formula as export_tiny_model.py; the declination is computed once a day
+float sunFactor(const TinyClock& clock) {
+  static int cachedDay = -1;
+  static float sinDeclinationTerm;
+  static float cosDeclinationTerm;
+  if (clock.dayOfYear != cachedDay) {
+    float declination = 23.44f * TINY_DEGREE * sinf(360 * TINY_DEGREE * (284 + clock.dayOfYear) / 365);
+    sinDeclinationTerm = sinf(TINY_LATITUDE * TINY_DEGREE) * sinf(declination);
+    cosDeclinationTerm = cosf(TINY_LATITUDE * TINY_DEGREE) * cosf(declination);
+    cachedDay = clock.dayOfYear;
+  }
+  float hourAngle = 15 * TINY_DEGREE * (clock.solarHour - TINY_SOLAR_NOON);
+  return max(sinDeclinationTerm + cosDeclinationTerm * cosf(hourAngle), 0.0f);
+}
+
+// Linear fade from the observation (weight 1) to the default (weight 0)
+float tinyRecall(float observed, unsigned long at, float fallback) {
+  if (at == 0) return fallback;
+  unsigned long age = millis() - at;
+  if (age >= TINY_MODEL_MEMORY) return fallback;
+  float weight = 1 - (float)age / TINY_MODEL_MEMORY;
+  return fallback + (observed - fallback) * weight;
+}
+
+void observeForModel(float pvPower, float load) {
+  TinyClock clock;
+  if (!readTinyClock(clock)) return;
+  unsigned long now = millis();
+  
+  float sun = sunFactor(clock);
+  if (sun >= TINY_MIN_SUN) {
+    tinyObservation.clearness = constrain(pvPower / (sun * TINY_PV_NORM), 0.0f, 1.5f);
+    tinyObservation.clearnessAt = now ? now : 1;
+  }
+  tinyObservation.load = load;
+  tinyObservation.loadAt = now ? now : 1;
+}
+
+// False without a clock
+bool tinyModelPredict(float& pvPower, float& consumption) {
+  BENCH_SCOPE(BENCH_TINY_MODEL);
+  TinyClock clock;
+  if (!readTinyClock(clock)) return false;
+  
+  float sun = sunFactor(clock) * TINY_PV_NORM;
+  if (sun > 0) {
+    float clearness = tinyRecall(tinyObservation.clearness, tinyObservation.clearnessAt,
+                                 TINY_PV_CLEARNESS * TINY_WEIGHT_SCALE);
+    pvPower = max((TINY_PV_WEIGHTS[0] * sun + TINY_PV_WEIGHTS[1] * sun * clearness) * TINY_WEIGHT_SCALE
+                  + TINY_PV_BIAS, 0.0f);
+  } else {
+    pvPower = 0;
+  }
+  
+  float profile = TINY_LOAD_PROFILE[(int)clock.hour % 24];
+  float recentLoad = tinyRecall(tinyObservation.load, tinyObservation.loadAt, profile);
+  consumption = max((TINY_LOAD_WEIGHTS[0] * profile + TINY_LOAD_WEIGHTS[1] * recentLoad) * TINY_WEIGHT_SCALE
+                    + (clock.weekend ? TINY_LOAD_WEEKEND : 0) + TINY_LOAD_BIAS, 0.0f);
+  return true;
+}
+#endif
+
+// ===== Prediction freshness =====
+bool predictionIsFresh() {
+  return havePrediction && (millis() - predictionReceivedAt) <= PREDICTION_MAX_AGE;
+}
+
+// PV estimate for stale predictions: the on-device model, which also
+// refreshes predictedConsumption, or half of clear sky without a clock
+float fallbackPvPower() {
+#if EMS_TINY_MODEL
+  float pvPower;
+  if (tinyModelPredict(pvPower, predictedConsumption)) return pvPower;
+#endif
+  return CLEAR_SKY_PV[getCurrentHour() % 24] * STALE_PV_DERATE;
+}
+
+// ===== Prediction Cache =====
+// Timestamped points, oldest first: the last prediction at the time it
+// arrived, then the forecast for the following hours at mid-hour (a forecast
+// row is the mean of its hour). Each control tick interpolates linearly
+// between the two points around now and holds the last one past the end.
+// Without a clock, or without a fresh forecast, the prediction is held as is.
+#if EMS_PREDICTION_CACHE
+const int PREDICTION_CACHE_POINTS = 4;   // Prediction + 3 forecast hours
+
+struct PredictionPoint {
+  long at;               // Seconds after local midnight of the prediction's day
+  float pvPower;
+  float consumption;
+};
+
+// Control loop only
+PredictionPoint predictionCache[PREDICTION_CACHE_POINTS];
+int predictionCacheSize = 0;
+uint32_t cachedForecastVersion = 0;
+
+bool secondsOfDay(long& seconds) {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) return false;   // Never wait in the control loop
+  seconds = timeinfo.tm_hour * 3600L + timeinfo.tm_min * 60 + timeinfo.tm_sec;
+  return true;
+}
+
+// predictionCache[0] holds the prediction; the forecast points after it are
+// rebuilt whenever either side changes
+void rebuildPredictionCache(const ForecastProfile& forecast) {
+  predictionCacheSize = 1;
+  if (forecast.hoursPresent == 0 || millis() - forecast.receivedAt > FORECAST_MAX_AGE) return;
+  
+  long start = predictionCache[0].at;
+  long midHour = (start / 3600) * 3600 + 1800;
+  if (midHour <= start) midHour += 3600;
+  for (; predictionCacheSize < PREDICTION_CACHE_POINTS; midHour += 3600) {
+    int hour = (midHour / 3600) % FORECAST_HOURS;
+    if (!(forecast.hoursPresent & (1UL << hour))) break;
+    PredictionPoint& point = predictionCache[predictionCacheSize++];
+    point.at = midHour;
+    point.pvPower = forecast.pvPower[hour];
+    point.consumption = forecast.consumption[hour];
+  }
+}
+
+void cachePrediction(float pvPower, float consumption) {
+  long now;
+  if (!secondsOfDay(now)) {
+    predictionCacheSize = 0;
+    return;
+  }
+  predictionCache[0].at = now;
+  predictionCache[0].pvPower = pvPower;
+  predictionCache[0].consumption = consumption;
+  
+  ForecastProfile forecast;
+  cachedForecastVersion = forecastState.read(forecast);
+  rebuildPredictionCache(forecast);
+}
+
+void interpolatePrediction() {
+  if (predictionCacheSize == 0) return;
+  if (forecastState.currentVersion() != cachedForecastVersion) {
+    ForecastProfile forecast;
+    cachedForecastVersion = forecastState.read(forecast);
+    rebuildPredictionCache(forecast);
+  }
+  
+  long now;
+  if (!secondsOfDay(now)) return;
+  if (now < predictionCache[0].at) now += 86400;   // Past midnight
+  
+  int next = 1;
+  while (next < predictionCacheSize && predictionCache[next].at <= now) next++;
+  if (next == predictionCacheSize) {
+    predictedPvPower = predictionCache[next - 1].pvPower;
+    predictedConsumption = predictionCache[next - 1].consumption;
+    return;
+  }
+  
+  const PredictionPoint& a = predictionCache[next - 1];
+  const PredictionPoint& b = predictionCache[next];
+  float f = (float)(now - a.at) / (b.at - a.at);
+  predictedPvPower = a.pvPower + (b.pvPower - a.pvPower) * f;
+  predictedConsumption = a.consumption + (b.consumption - a.consumption) * f;
+}
+#endif
+
+// ===== Power Metering =====
+// CT clamps and voltage sensors on ADC1 (ADC2 is unusable with WiFi on)
+// are sampled by the ADC's DMA engine into a ring buffer. The meter task
+// reads whole frames and keeps running integer sums per channel and per
+// voltage/current pair; a window closes after METER_WINDOW_CYCLES mains
+// cycles, detected as rising zero crossings on the sync channel, so RMS
+// and real power are computed over whole periods. Per sample the cost is a
+// few adds and one multiply per sum; the sums are turned into RMS values
+// and real power (mean of v*i, minus the DC product for AC pairs) once per
+// window.
+struct MeterChannel {
+  uint8_t pin;           // ADC1 GPIO (32-39)
+  bool ac;               // AC: offset is the window mean; DC: fixed `zero`
+  float scale;           // Volts or amps per ADC count
+  uint16_t zero;         // Raw count at 0 for DC channels
+};
+
+struct MeterPair {
+  uint8_t voltage;       // METER_CHANNELS index
+  uint8_t current;
+};
+
+constexpr MeterChannel METER_CHANNELS[] = {
+  {36, true,  0.35,   0},      // Mains voltage, ZMPT101B (sync channel)
+  {39, true,  0.0125, 0},      // House load current, SCT-013-030
+  {34, false, 0.05,   0},      // PV voltage divider
+  {35, false, 0.01,   1850},   // PV current, hall sensor
+};
+constexpr int METER_CHANNEL_COUNT = sizeof(METER_CHANNELS) / sizeof(METER_CHANNELS[0]);
+
+constexpr bool meterUsesPin(uint8_t pin, int i = 0) {
+  return i < METER_CHANNEL_COUNT && (METER_CHANNELS[i].pin == pin || meterUsesPin(pin, i + 1));
+}
+#if EMS_FAST_PATH
+static_assert(!meterUsesPin(GRID_SENSE_PIN) && !meterUsesPin(OVERCURRENT_PIN),
+              "Fast-path inputs must not be meter channels");
+#endif
+
+enum MeterPower : uint8_t { METER_LOAD_POWER, METER_PV_POWER };
+constexpr MeterPair METER_PAIRS[] = {
+  {0, 1},   // METER_LOAD_POWER
+  {2, 3},   // METER_PV_POWER
+};
+constexpr int METER_PAIR_COUNT = sizeof(METER_PAIRS) / sizeof(METER_PAIRS[0]);
+
+const uint32_t METER_SAMPLE_RATE = 2000;          // Per channel, after decimation
+const int METER_WINDOW_CYCLES = 10;               // 200 ms at 50 Hz
+const uint32_t METER_MAX_WINDOW = METER_SAMPLE_RATE / 2;   // Scans; closes a window without mains
+const unsigned long METER_MAX_AGE = 2000;         // Older readings fall back to estimates
+const uint32_t METER_FRAME_BYTES = 1024;
+const int32_t METER_CROSSING_BAND = 20;           // Counts around the offset
+
+struct MeterReading {
+  float rms[METER_CHANNEL_COUNT];      // V or A; plain mean for DC channels
+  float power[METER_PAIR_COUNT];       // W
+  float frequency;                     // Hz, 0 without mains
+  unsigned long takenAt;               // millis()
+};
+
+SnapshotBuffer<MeterReading> meterState;
+
+#if EMS_METERING
+struct MeterSums {
+  uint32_t count[METER_CHANNEL_COUNT];
+  uint64_t sum[METER_CHANNEL_COUNT];
+  uint64_t squares[METER_CHANNEL_COUNT];
+  int64_t products[METER_PAIR_COUNT];
+  uint32_t productCount[METER_PAIR_COUNT];
+  uint32_t scans;
+  int cycles;
+};
+
+// DMA mode has a floor on the conversion rate over all channels (20 kHz on
+// the classic ESP32), so the ADC runs a whole multiple faster and every
+// METER_DECIMATION raw samples of a channel are averaged into one
+constexpr uint32_t METER_DECIMATION = (SOC_ADC_SAMPLE_FREQ_THRES_LOW + METER_SAMPLE_RATE * METER_CHANNEL_COUNT - 1)
+                                      / (METER_SAMPLE_RATE * METER_CHANNEL_COUNT);
+constexpr uint32_t METER_ADC_RATE = METER_SAMPLE_RATE * METER_CHANNEL_COUNT * METER_DECIMATION;
+static_assert(METER_ADC_RATE >= SOC_ADC_SAMPLE_FREQ_THRES_LOW && METER_ADC_RATE <= SOC_ADC_SAMPLE_FREQ_THRES_HIGH,
+              "Meter ADC rate outside what adc_continuous_config() accepts");
+
+adc_continuous_handle_t meterAdc = NULL;
+int8_t meterChannelOf[8];                    // ADC1 channel -> METER_CHANNELS index
+
+bool initMeterAdc() {
+  adc_continuous_handle_cfg_t handleConfig = {};
+  handleConfig.max_store_buf_size = METER_FRAME_BYTES * 4;
+  handleConfig.conv_frame_size = METER_FRAME_BYTES;
+  if (adc_continuous_new_handle(&handleConfig, &meterAdc) != ESP_OK) return false;
+  
+  adc_digi_pattern_config_t pattern[METER_CHANNEL_COUNT] = {};
+  memset(meterChannelOf, -1, sizeof(meterChannelOf));
+  for (int i = 0; i < METER_CHANNEL_COUNT; i++) {
+    adc_unit_t unit;
+    adc_channel_t channel;
+    if (adc_continuous_io_to_channel(METER_CHANNELS[i].pin, &unit, &channel) != ESP_OK || unit != ADC_UNIT_1) {
+      LOG_ERROR("Meter pin %d is not on ADC1", METER_CHANNELS[i].pin);
+      return false;
+    }
+    pattern[i].atten = ADC_ATTEN_DB_12;
+    pattern[i].channel = channel;
+    pattern[i].unit = ADC_UNIT_1;
+    pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    meterChannelOf[channel] = i;
+  }
+  
+  adc_continuous_config_t config = {};
+  config.pattern_num = METER_CHANNEL_COUNT;
+  config.adc_pattern = pattern;
+  config.sample_freq_hz = METER_ADC_RATE;
+  config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  if (adc_continuous_config(meterAdc, &config) != ESP_OK) return false;
+  return adc_continuous_start(meterAdc) == ESP_OK;
+}
+
+// Turn one window of sums into a reading. `offset` receives the sync
+// channel mean, used to find zero crossings in the next window.
+void publishMeterWindow(const MeterSums& sums, int32_t& offset) {
+  MeterReading reading;
+  float mean[METER_CHANNEL_COUNT];
+  
+  for (int i = 0; i < METER_CHANNEL_COUNT; i++) {
+    const MeterChannel& channel = METER_CHANNELS[i];
+    uint32_t n = sums.count[i] ? sums.count[i] : 1;
+    mean[i] = (float)sums.sum[i] / n;
+    if (channel.ac) {
+      float variance = (float)sums.squares[i] / n - mean[i] * mean[i];
+      reading.rms[i] = sqrtf(variance > 0 ? variance : 0) * channel.scale;
+    } else {
+      reading.rms[i] = (mean[i] - channel.zero) * channel.scale;
+    }
+  }
+  
+  for (int p = 0; p < METER_PAIR_COUNT; p++) {
+    const MeterChannel& voltage = METER_CHANNELS[METER_PAIRS[p].voltage];
+    const MeterChannel& current = METER_CHANNELS[METER_PAIRS[p].current];
+    uint32_t n = sums.productCount[p] ? sums.productCount[p] : 1;
+    float mv = mean[METER_PAIRS[p].voltage];
+    float mi = mean[METER_PAIRS[p].current];
+    float zv = voltage.ac ? mv : voltage.zero;
+    float zi = current.ac ? mi : current.zero;
+    // mean((v - zv)(i - zi)) expanded so only sum(v*i) is needed per sample
+    float meanProduct = (float)sums.products[p] / n - zv * mi - zi * mv + zv * zi;
+    reading.power[p] = meanProduct * voltage.scale * current.scale;
+  }
+  
+  float seconds = (float)sums.scans / METER_SAMPLE_RATE;
+  reading.frequency = (sums.cycles > 0 && seconds > 0) ? sums.cycles / seconds : 0;
+  reading.takenAt = millis();
+  meterState.publish(reading);
+  
+  offset = (int32_t)mean[0];
+}
+
+void meterTaskLoop(void* parameter) {
+  static uint8_t frame[METER_FRAME_BYTES];
+  MeterSums sums = {};
+  uint16_t latest[METER_CHANNEL_COUNT] = {};
+  uint32_t decimationSum[METER_CHANNEL_COUNT] = {};
+  uint32_t decimationCount[METER_CHANNEL_COUNT] = {};
+  int32_t offset = 2048;
+  bool above = false;
+  
+  for (;;) {
+    uint32_t length = 0;
+    if (adc_continuous_read(meterAdc, frame, sizeof(frame), &length, 100) != ESP_OK) continue;
+    
+    for (uint32_t pos = 0; pos + SOC_ADC_DIGI_RESULT_BYTES <= length; pos += SOC_ADC_DIGI_RESULT_BYTES) {
+      const adc_digi_output_data_t* result = (const adc_digi_output_data_t*)&frame[pos];
+      uint32_t adcChannel = result->type1.channel;
+      if (adcChannel >= 8 || meterChannelOf[adcChannel] < 0) continue;
+      
+      int i = meterChannelOf[adcChannel];
+      decimationSum[i] += result->type1.data;
+      if (++decimationCount[i] < METER_DECIMATION) continue;
+      uint16_t raw = decimationSum[i] / METER_DECIMATION;
+      decimationSum[i] = 0;
+      decimationCount[i] = 0;
+      latest[i] = raw;
+      sums.count[i]++;
+      sums.sum[i] += raw;
+      sums.squares[i] += (uint32_t)raw * raw;
+      
+      // Pair with the latest voltage sample: one scan apart at most
+      for (int p = 0; p < METER_PAIR_COUNT; p++) {
+        if (METER_PAIRS[p].current != i) continue;
+        sums.products[p] += (int32_t)latest[METER_PAIRS[p].voltage] * raw;
+        sums.productCount[p]++;
+      }
+      
+      if (i != 0) continue;
+      sums.scans++;
+      
+      // Rising zero crossing with a small band against noise; each window
+      // after the first starts on one, so it spans whole cycles
+      if (!above && (int32_t)raw > offset + METER_CROSSING_BAND) {
+        above = true;
+        sums.cycles++;
+      } else if (above && (int32_t)raw < offset - METER_CROSSING_BAND) {
+        above = false;
+      }
+      
+      if (sums.cycles >= METER_WINDOW_CYCLES || sums.scans >= METER_MAX_WINDOW) {
+        publishMeterWindow(sums, offset);
+        sums = {};
+      }
+    }
+  }
+}
+
+void startMetering() {
+  if (!initMeterAdc()) {
+    LOG_ERROR("ADC DMA setup failed - metering disabled");
+    return;
+  }
+  xTaskCreatePinnedToCore(meterTaskLoop, "meter", METER_STACK, NULL,
+                          METER_PRIORITY, NULL, METER_CORE);
+}
+#endif
+
+// Control loop only: replace the estimates with measurements while the
+// meter is delivering
+bool applyMeterReading() {
+#if EMS_METERING
+  MeterReading reading;
+  if (meterState.read(reading) == 0) return false;
+  if (millis() - reading.takenAt > METER_MAX_AGE) return false;
+  
+  currentPvPower = max(reading.power[METER_PV_POWER], 0.0f);
+  totalLoad = max(reading.power[METER_LOAD_POWER], 0.0f);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool meterActive = false;
+
+// ===== Energy Integration =====
+// Every energy figure is power x measured elapsed time, so SOC and the daily
+// counters stay right however late or irregular the control tick runs.
+const int64_t MAX_ENERGY_STEP_US = 60000000;   // Longer gaps are not extrapolated
+
+int64_t lastEnergyStepUs = 0;
+int energyDay = -1;                   // tm_yday of the running totals
+
+// Microseconds since the previous call, from the monotonic timer
+int64_t energyStepMicros() {
+  int64_t now = esp_timer_get_time();
+  int64_t dt = (lastEnergyStepUs == 0) ? (int64_t)CONTROL_INTERVAL * 1000 : now - lastEnergyStepUs;
+  lastEnergyStepUs = now;
+  return min(dt, MAX_ENERGY_STEP_US);
+}
+
+float energyStepSeconds() {
+  return energyStepMicros() / 1e6;
+}
+
+// Reset the daily totals when the local date changes. Needs NTP time; until
+// it is available the totals simply keep running. Returns true on a reset.
+bool rolloverDailyEnergy() {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) return false;
+  
+  bool reset = false;
+  if (energyDay != timeinfo.tm_yday) {
+    if (energyDay >= 0) {
+      LOG_INFO("Daily energy: PV %.0f Wh, load %.0f Wh, grid %.0f Wh",
+                    dailyEnergy.pvGeneration, dailyEnergy.consumption, dailyEnergy.gridImport);
+      dailyEnergy = {};
+      reset = true;
+    }
+    energyDay = timeinfo.tm_yday;
+  }
+  return reset;
+}
+
+// Accumulate one step of average powers (W) over dt seconds
+void integrateEnergy(float dt, float pv, float load, float charge, float discharge, float grid) {
+  float hours = dt / 3600.0;
+  dailyEnergy.pvGeneration += pv * hours;
+  dailyEnergy.consumption += load * hours;
+  dailyEnergy.batteryCharge += charge * hours;
+  dailyEnergy.batteryDischarge += discharge * hours;
+  dailyEnergy.gridImport += grid * hours;
+}
+
+#if EMS_FIXED_POINT
+// ===== Fixed-Point Kernel =====
+// Power in mW, time in us, energy in uJ (mW x us = nJ). Capacity and the
+// efficiencies are folded into Q24 factors at compile time, so a step is
+// integer multiply/shift only. fxEnergyStep() touches nothing but its
+// arguments and is placed in IRAM, so a future metering timer ISR can call
+// it directly.
+constexpr int FX_SHIFT = 24;
+constexpr int64_t FX_UJ_PER_WH = 3600000000LL;
+constexpr int64_t FX_CAPACITY_UJ = (int64_t)batteryCapacity * FX_UJ_PER_WH;
+constexpr int64_t FX_UJ_PER_MILLI_PERCENT = FX_CAPACITY_UJ / 100000;
+constexpr int32_t FX_MAX_BATTERY_MW = (int32_t)(maxBatteryPower * 1000);
+constexpr int32_t FX_GRID_DEADBAND_MW = 100000;               // Matches "deficit > 100 W"
+constexpr int64_t FX_CHARGE_FACTOR = (int64_t)(CHARGE_EFFICIENCY * (1 << FX_SHIFT) / 1000.0 + 0.5);
+constexpr int64_t FX_DISCHARGE_FACTOR = (int64_t)((1 << FX_SHIFT) / (DISCHARGE_EFFICIENCY * 1000.0) + 0.5);
+
+constexpr int64_t fxSocEnergy(int percent) {
+  return FX_CAPACITY_UJ / 100 * percent;
+}
+
+struct FxStep {
+  // Inputs
+  int64_t dtUs;
+  int32_t pvMw;
+  int32_t loadMw;
+  int32_t heaterMw;
+  bool heaterPlanned;            // Plan says heat water before the battery is full
+  bool heaterOn;                 // Heater relay state; its power is in loadMw
+  bool gridAvailable;            // False while islanded
+  int64_t dischargeFloorUj;
+  // Outputs
+  int32_t chargeMw;
+  int32_t dischargeMw;
+  int32_t gridImportMw;
+  bool gridPower;
+  bool waterHeater;              // Requested heater state
+  bool shedActive;               // In: previous state, out: new state
+};
+
+struct FxEnergyTotals {
+  int64_t pv;
+  int64_t load;
+  int64_t charge;
+  int64_t discharge;
+  int64_t grid;
+};
+
+// Control loop only
+int64_t fxBatteryUj = 0;
+FxEnergyTotals fxDaily = {};
+int32_t fxPvMw = 0;
+int32_t fxLoadMw = 0;
+
+int32_t toMilliwatts(float watts) {
+  return (int32_t)lroundf(watts * 1000);
+}
+
+void fxSetBatterySOC(float soc) {
+  fxBatteryUj = (int64_t)lroundf(soc * 1000) * FX_UJ_PER_MILLI_PERCENT;
+}
+
+float fxBatterySOC() {
+  return (float)(fxBatteryUj / FX_UJ_PER_MILLI_PERCENT) / 1000.0;
+}
+
+// Same decisions as the float manageEnergy(), in integer units
+IRAM_ATTR void fxEnergyStep(FxStep& step, int64_t& batteryUj) {
+  int32_t balance = step.pvMw - step.loadMw;
+  step.chargeMw = 0;
+  step.dischargeMw = 0;
+  step.gridImportMw = 0;
+  
+  // Power the heater could draw, and the band edge for its current state
+  int32_t heaterShare = step.heaterOn ? step.heaterMw : 0;
+  int32_t heaterThreshold = step.heaterOn ? step.heaterMw / 2 : step.heaterMw / 5 * 4;
+  int64_t heaterSoc = fxSocEnergy(step.heaterOn ? HEATER_OFF_SOC : HEATER_ON_SOC);
+  
+  if (balance > 0) {
+    bool heaterFirst = step.heaterPlanned && balance + heaterShare > heaterThreshold;
+    if (heaterFirst && !step.heaterOn) balance -= step.heaterMw;
+    
+    if (batteryUj < FX_CAPACITY_UJ && balance > 0) {
+      step.chargeMw = min(balance, FX_MAX_BATTERY_MW);
+      batteryUj += ((int64_t)step.chargeMw * step.dtUs * FX_CHARGE_FACTOR) >> FX_SHIFT;
+      if (batteryUj > FX_CAPACITY_UJ) batteryUj = FX_CAPACITY_UJ;
+      balance -= step.chargeMw;
+    }
+    
+    step.waterHeater = heaterFirst || (batteryUj >= heaterSoc && balance + heaterShare > heaterThreshold);
+    step.gridPower = false;
+  } else {
+    int32_t deficit = -balance;
+    int64_t floorUj = step.gridAvailable ? max(step.dischargeFloorUj, fxSocEnergy(20)) : 0;
+    
+    if (batteryUj > floorUj) {
+      step.dischargeMw = min(deficit, FX_MAX_BATTERY_MW);
+      batteryUj -= ((int64_t)step.dischargeMw * step.dtUs * FX_DISCHARGE_FACTOR) >> FX_SHIFT;
+      if (batteryUj < 0) batteryUj = 0;
+      deficit -= step.dischargeMw;
+    }
+    
+    step.gridPower = step.gridAvailable && (batteryUj <= fxSocEnergy(20) || deficit > FX_GRID_DEADBAND_MW);
+    step.gridImportMw = step.gridPower ? deficit : 0;
+    step.waterHeater = step.heaterOn && (step.heaterPlanned || batteryUj >= heaterSoc) && balance + heaterShare > heaterThreshold;
+  }
+  
+  int64_t shedSoc = fxSocEnergy(step.shedActive ? SHED_EXIT_SOC : SHED_ENTER_SOC);
+  step.shedActive = batteryUj < shedSoc && !step.gridPower;
+}
+
+// nJ to uJ; the constant divisor compiles to a multiply
+IRAM_ATTR void fxIntegrate(const FxStep& step, FxEnergyTotals& totals) {
+  totals.pv += (int64_t)step.pvMw * step.dtUs / 1000;
+  totals.load += (int64_t)step.loadMw * step.dtUs / 1000;
+  totals.charge += (int64_t)step.chargeMw * step.dtUs / 1000;
+  totals.discharge += (int64_t)step.dischargeMw * step.dtUs / 1000;
+  totals.grid += (int64_t)step.gridImportMw * step.dtUs / 1000;
+}
+
+// Efficiency in milli-percent; the one division left is by a runtime value
+int32_t fxEfficiency(int32_t loadMw, int32_t pvMw, bool grid) {
+  if (loadMw == 0) return 100000;
+  int32_t available = pvMw + (grid ? 5000000 : 0);
+  if (available <= 0) return 0;
+  int64_t efficiency = (int64_t)loadMw * 100000 / available;
+  return (int32_t)constrain(efficiency, (int64_t)0, (int64_t)100000);
+}
+
+float uJToWh(int64_t energy) {
+  return (float)(energy / 1000) / (FX_UJ_PER_WH / 1000);
+}
+#endif
+
+// ===== Look-Ahead Dispatch =====
+// Receding-horizon plan over the next 24 h, solved by dynamic programming
+// over 5% SOC buckets. For every (hour, bucket) pair the planner stores the
+// best SOC to reach by the end of that hour, and whether the water heater
+// and the deferrable loads (Washing, AC) should run. The cost is grid import
+// in Wh, minus a small credit for heating water and plus a penalty for
+// deferring loads, so both only happen when they save grid energy: a load
+// is deferred only where running it would end up on the grid, directly or
+// through a battery emptied for later hours. Costs within PLAN_TIE_WH of
+// each other go to the SOC reactive control would reach, so the plan only
+// holds charge back (PLAN_RESERVE) where that strictly saves grid energy.
+// The planner runs in its own low-priority task; the control tick only
+// looks up the entry for the current hour and SOC.
+const int SOC_BUCKETS = 21;                  // 0..100% in 5% steps
+const float SOC_BUCKET_PERCENT = 5.0;
+const int SOC_RESERVE_BUCKET = 4;            // 20%, never planned below
+const int MAX_BUCKET_STEP = 6;               // 30% per hour bounds the search
+const float WATER_HEATER_CREDIT = 0.5;       // Per Wh of heat, < 1 so grid heating never pays
+const float DEFER_PENALTY = 0.95;            // Per Wh of deferred load, between battery and grid energy
+const float PLAN_TIE_WH = 1.0;               // Costs this close count as equal
+const unsigned long PLAN_INTERVAL = 900000;  // Re-solve every 15 minutes
+const unsigned long PLAN_MAX_AGE = 7200000;  // Ignore a plan older than 2 h
+
+enum PlanFlags : uint8_t {
+  PLAN_WATER_HEATER = 0x20,
+  PLAN_DEFERRABLE = 0x40,
+  PLAN_RESERVE = 0x80                        // Target is above where reactive control would end
+};
+const uint8_t PLAN_TARGET_MASK = 0x1F;       // Target bucket for the end of the hour
+
+struct DispatchPlan {
+  bool valid;
+  uint8_t startHour;
+  unsigned long solvedAt;
+  uint8_t policy[FORECAST_HOURS][SOC_BUCKETS];
+};
+
+SnapshotBuffer<DispatchPlan> planState;
+
+// Control loop only
+DispatchPlan activePlan;
+uint32_t appliedPlanVersion = 0;
+bool planActive = false;
+uint8_t planStep = 0;
+int planHour = -1;                           // Hour planStep was taken for
+float planStartSoc = 0;                      // SOC and second of the hour it was taken at
+int planStartSecond = 0;
+float planFloor = 0;                         // Discharge floor on the way to the target
+
+int socBucket(float soc) {
+  int bucket = (int)lroundf(soc / SOC_BUCKET_PERCENT);
+  return constrain(bucket, 0, SOC_BUCKETS - 1);
+}
+
+// Where an hour at `balance` W (PV minus load) takes the battery from
+// `bucket` without a plan: charge from surplus, discharge to the reserve
+int reactiveBucket(int bucket, float balance) {
+  const float bucketWh = batteryCapacity * SOC_BUCKET_PERCENT / 100.0;
+  float power = constrain(balance, -maxBatteryPower, maxBatteryPower);
+  float stored = power > 0 ? power * CHARGE_EFFICIENCY : power / DISCHARGE_EFFICIENCY;
+  int target = bucket + (int)lroundf(stored / bucketWh);
+  if (target < bucket) target = max(target, min(bucket, SOC_RESERVE_BUCKET));
+  return constrain(target, 0, SOC_BUCKETS - 1);
+}
+
+#if EMS_LOOKAHEAD
+// Planner task only
+void solveDispatchPlan() {
+  ForecastProfile forecast;
+  forecastState.read(forecast);
+  if (forecast.hoursPresent == 0 || millis() - forecast.receivedAt > FORECAST_MAX_AGE) return;
+  
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) return;
+  
+  ControlSnapshot state;
+  controlState.read(state);
+  int startBucket = socBucket(state.batterySOC);
+  
+  // Hours the server did not cover: clear-sky PV and the mean known load
+  float meanLoad = 0;
+  int known = 0;
+  for (int h = 0; h < FORECAST_HOURS; h++) {
+    if (forecast.hoursPresent & (1UL << h)) {
+      meanLoad += forecast.consumption[h];
+      known++;
+    }
+  }
+  meanLoad /= known;
+  
+  const float bucketWh = batteryCapacity * SOC_BUCKET_PERCENT / 100.0;
+  constexpr float deferrableLoad = ratedLoad(DEFERRABLE_DEVICES);
+  
+  // Cost-to-go at the end of the horizon: charge missing against today's
+  // SOC is worth the grid energy it would have displaced
+  float next[SOC_BUCKETS];
+  float cost[SOC_BUCKETS];
+  for (int b = 0; b < SOC_BUCKETS; b++) {
+    next[b] = max(startBucket - b, 0) * bucketWh * DISCHARGE_EFFICIENCY;
+  }
+  
+  DispatchPlan& plan = planState.writeSlot();
+  plan.startHour = timeinfo.tm_hour;
+  
+  for (int step = FORECAST_HOURS - 1; step >= 0; step--) {
+    int hour = (plan.startHour + step) % FORECAST_HOURS;
+    bool present = forecast.hoursPresent & (1UL << hour);
+    float pv = present ? forecast.pvPower[hour] : CLEAR_SKY_PV[hour] * STALE_PV_DERATE;
+    float baseLoad = present ? forecast.consumption[hour] : meanLoad;
+    
+    for (int b = 0; b < SOC_BUCKETS; b++) {
+      float best = 1e30;
+      uint8_t bestPolicy = b;
+      
+      for (int heater = 0; heater <= 1; heater++) {
+        for (int deferrable = 0; deferrable <= 1; deferrable++) {
+          float load = baseLoad + heater * waterHeaterLoad + deferrable * deferrableLoad;
+          float bias = deferrable ? 0 : DEFER_PENALTY * deferrableLoad;
+          bias -= heater * WATER_HEATER_CREDIT * waterHeaterLoad;
+          uint8_t flags = (heater ? PLAN_WATER_HEATER : 0) | (deferrable ? PLAN_DEFERRABLE : 0);
+          int reactive = reactiveBucket(b, pv - load);
+          
+          for (int target = max(b - MAX_BUCKET_STEP, 0); target <= min(b + MAX_BUCKET_STEP, SOC_BUCKETS - 1); target++) {
+            if (target < b && target < SOC_RESERVE_BUCKET) continue;
+            
+            // Battery energy on the AC side: positive charges, negative discharges
+            float stored = (target - b) * bucketWh;
+            float battery = stored > 0 ? stored / CHARGE_EFFICIENCY : stored * DISCHARGE_EFFICIENCY;
+            if (fabs(battery) > maxBatteryPower) continue;  // 1 h step: W == Wh
+            
+            float gridImport = max(load + battery - pv, 0.0f);
+            float total = gridImport + bias + next[target];
+            // Within PLAN_TIE_WH the plan does what the reactive controller
+            // would, so it only holds or spends charge where that pays
+            bool closer = abs(target - reactive) < abs((bestPolicy & PLAN_TARGET_MASK) - reactive);
+            if (total < best - PLAN_TIE_WH || (total <= best + PLAN_TIE_WH && closer)) {
+              best = min(best, total);
+              bestPolicy = target | flags | (target > reactive ? PLAN_RESERVE : 0);
+            }
+          }
+        }
+      }
+      
+      cost[b] = best;
+      plan.policy[step][b] = bestPolicy;
+    }
+    memcpy(next, cost, sizeof(next));
+  }
+  
+  plan.solvedAt = millis();
+  plan.valid = true;
+  planState.commit();
+  
+  uint8_t now = plan.policy[0][startBucket];
+  LOG_INFO("Dispatch plan solved: %.0f Wh grid over 24 h, this hour target %d%%%s%s",
+                next[startBucket], (int)((now & PLAN_TARGET_MASK) * SOC_BUCKET_PERCENT),
+                (now & PLAN_WATER_HEATER) ? ", water heater" : "",
+                (now & PLAN_DEFERRABLE) ? ", deferrable loads" : "");
+}
+
+void plannerTaskLoop(void* parameter) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PLAN_INTERVAL));
+    solveDispatchPlan();
+  }
+}
+
+void startPlanner() {
+  xTaskCreatePinnedToCore(plannerTaskLoop, "planner", PLANNER_STACK, NULL,
+                          PLANNER_PRIORITY, &plannerTask, PLANNER_CORE);
+}
+#endif
+
+// Control loop only: the plan entry for this hour is taken once, when the
+// hour starts (or the first plan arrives), so its flags hold for the hour
+// instead of following every SOC bucket or re-solve. A reserve target is a
+// trajectory, not a floor: the discharge floor moves from the SOC the hour
+// started at to the target as the hour passes, and never above that SOC.
+void updatePlanStep() {
+  if (planState.currentVersion() != appliedPlanVersion) {
+    appliedPlanVersion = planState.read(activePlan);
+  }
+  
+  struct tm timeinfo;
+  if (!activePlan.valid || millis() - activePlan.solvedAt > PLAN_MAX_AGE || !getLocalTime(&timeinfo, 0)) {
+    planActive = false;
+    return;
+  }
+  
+  int second = timeinfo.tm_min * 60 + timeinfo.tm_sec;
+  if (!planActive || timeinfo.tm_hour != planHour) {
+    int step = (timeinfo.tm_hour - activePlan.startHour + FORECAST_HOURS) % FORECAST_HOURS;
+    planStep = activePlan.policy[step][socBucket(batterySOC)];
+    planHour = timeinfo.tm_hour;
+    planStartSoc = batterySOC;
+    planStartSecond = second;
+    planActive = true;
+  }
+  
+  // Only a reserve binds; elsewhere the plan ends where reactive control would
+  if (!(planStep & PLAN_RESERVE)) {
+    planFloor = 0;
+    return;
+  }
+  float drop = min((planStep & PLAN_TARGET_MASK) * SOC_BUCKET_PERCENT - planStartSoc, 0.0f);
+  float progress = (float)(second - planStartSecond) / (3600 - planStartSecond);
+  planFloor = planStartSoc + drop * constrain(progress, 0.0f, 1.0f);
+}
+
+// ===== Calculate system efficiency =====
+float calculateEfficiency() {
+  if (totalLoad == 0) return 100.0;
+  
+  float usedPower = totalLoad;
+  float totalAvailable = currentPvPower + (gridPower ? 5000 : 0);
+  
+  if (totalAvailable == 0) return 0;
+  
+  float efficiency = (usedPower / totalAvailable) * 100.0;
+  return constrain(efficiency, 0, 100);
+}
+
+#if EMS_FLEET
+// ===== Fleet Control =====
+// Control loop only
+FleetView fleetView = {};
+
+void updateFleetView() {
+  fleetState.read(fleetView);
+  if (millis() - fleetView.updatedAt > FLEET_BUDGET_TIMEOUT) fleetView.role = FLEET_LOCAL;
+}
+
+float fleetPeerLoad() {
+  return fleetView.role == FLEET_COORDINATOR ? fleetView.peerLoad : 0;
+}
+
+
+// Follower tick: the coordinator owns the battery, so take over its SOC,
+// grid and shedding state and only run the water heater on spare budget
+void followFleet() {
+  currentPvPower = fleetView.pvPower;
+  totalLoad = ratedLoad(deviceState) + (waterHeater ? waterHeaterLoad : 0);
+  batterySOC = fleetView.batterySOC;
+#if EMS_FIXED_POINT
+  fxSetBatterySOC(batterySOC);
+#endif
+  gridPower = fleetView.gridPower;
   
-  float usedPower = totalLoad;
-  float totalAvailable = currentPvPower + (gridPower ? 5000 : 0);
+  float spare = fleetView.budget - totalLoad + (waterHeater ? waterHeaterLoad : 0);
+  float heaterThreshold = waterHeaterLoad * (waterHeater ? HEATER_OFF_SURPLUS : HEATER_ON_SURPLUS);
+  int heaterSoc = waterHeater ? HEATER_OFF_SOC : HEATER_ON_SOC;
+  waterHeaterRequest = batterySOC >= heaterSoc && spare > heaterThreshold;
   
-  if (totalAvailable == 0) return 0;
+  bool wasShedding = shedActive;
+  shedActive = fleetView.shed;
+  if (shedActive) {
+    shedLoads();
+    if (!wasShedding) LOG_WARN("CRITICAL: Load shedding activated by coordinator");
+  } else if (wasShedding) {
+    LOG_INFO("Load shedding cleared");
+  }
   
-  float efficiency = (usedPower / totalAvailable) * 100.0;
-  return constrain(efficiency, 0, 100);
+  LOG_DEBUG("Fleet follower: budget %.0f W, load %.0f W, SOC %.1f%%",
+                fleetView.budget, totalLoad, batterySOC);
 }
+#endif
 
+#if !EMS_FIXED_POINT
 // ===== Energy Management Algorithm =====
 void manageEnergy() {
+  BENCH_SCOPE(BENCH_MANAGE_ENERGY);
+  float dt = energyStepSeconds();
+  float hours = dt / 3600.0;
+  float chargePower = 0;
+  float dischargePower = 0;
+  float gridImportPower = 0;
+  if (rolloverDailyEnergy()) resetSwitchCounters();
+  
   // Use AI prediction for current PV (or measure actual)
-  currentPvPower = predictedPvPower;
+  bool fresh = predictionIsFresh();
+  currentPvPower = fresh ? predictedPvPower : fallbackPvPower();
   
   // Calculate total load
-  totalLoad = 0;
-  for (int i = 0; i < 6; i++) {
-    if (devices[i]) {
-      totalLoad += deviceLoad[i];
-    }
-  }
+  totalLoad = ratedLoad(deviceState);
   if (waterHeater) {
     totalLoad += waterHeaterLoad;
   }
+  meterActive = applyMeterReading();
+#if EMS_TINY_MODEL
+  if (fresh || meterActive) observeForModel(currentPvPower, meterActive ? totalLoad : predictedConsumption);
+#endif
+#if EMS_FLEET
+  totalLoad += fleetPeerLoad();   // Coordinator: the battery serves every node
+#endif
   
   float powerBalance = currentPvPower - totalLoad;
   
-  Serial.println("\n===== ENERGY MANAGEMENT =====");
-  Serial.printf("PV Power: %.1f W\n", currentPvPower);
-  Serial.printf("Total Load: %.1f W\n", totalLoad);
-  Serial.printf("Balance: %.1f W\n", powerBalance);
-  Serial.printf("Battery SOC: %.1f%%\n", batterySOC);
+  // Power the heater could draw, and the band edge for its current state
+  float heaterShare = waterHeater ? waterHeaterLoad : 0;
+  float heaterThreshold = waterHeaterLoad * (waterHeater ? HEATER_OFF_SURPLUS : HEATER_ON_SURPLUS);
+  int heaterSoc = waterHeater ? HEATER_OFF_SOC : HEATER_ON_SOC;
+  
+  LOG_DEBUG("===== ENERGY MANAGEMENT =====");
+  LOG_DEBUG("PV Power: %.1f W", currentPvPower);
+  LOG_DEBUG("Total Load: %.1f W", totalLoad);
+  LOG_DEBUG("Balance: %.1f W", powerBalance);
+  LOG_DEBUG("Battery SOC: %.1f%%", batterySOC);
+  if (meterActive) {
+    LOG_DEBUG("PV and load measured");
+  } else if (!fresh) {
+    LOG_DEBUG("Prediction stale - using clear-sky fallback");
+  }
+  if (planActive) {
+    LOG_DEBUG("Plan: target SOC %d%%", (int)((planStep & PLAN_TARGET_MASK) * SOC_BUCKET_PERCENT));
+  }
   
   // ===== CASE 1: Surplus Power (Generation > Consumption) =====
   if (powerBalance > 0) {
-    Serial.println("MODE: Surplus - Charging Battery");
+    LOG_DEBUG("MODE: Surplus - Charging Battery");
+    
+    // The plan may heat water before the battery is full when the forecast
+    // fills the battery later anyway. A running heater is already in the load.
+    bool heaterFirst = planActive && (planStep & PLAN_WATER_HEATER) && powerBalance + heaterShare > heaterThreshold;
+    if (heaterFirst && !waterHeater) {
+      powerBalance -= waterHeaterLoad;
+    }
     
     // Charge battery if not full
-    if (batterySOC < 100) {
+    if (batterySOC < 100 && powerBalance > 0) {
       float chargeRate = min(powerBalance, maxBatteryPower);
-      float chargeEfficiency = 0.92;  // 92% charging efficiency
-      float energyStored = (chargeRate * chargeEfficiency / batteryCapacity) * 100;  // % per second
+      float energyStored = (chargeRate * CHARGE_EFFICIENCY * hours / batteryCapacity) * 100;  // % over dt
       
       batterySOC += energyStored;
       if (batterySOC > 100) batterySOC = 100;
       
       powerBalance -= chargeRate;
+      chargePower = chargeRate;
       gridPower = false;
       
-      Serial.printf("Charging battery: +%.2f%% (%.1f W)\n", energyStored, chargeRate);
+      LOG_DEBUG("Charging battery: +%.2f%% (%.1f W)", energyStored, chargeRate);
     }
     
     // If battery full and still surplus, turn on water heater
-    if (batterySOC >= 95 && powerBalance > waterHeaterLoad * 0.8) {
-      waterHeater = true;
-      Serial.println("Water heater: ON (using excess power)");
-    } else {
-      waterHeater = false;
+    waterHeaterRequest = heaterFirst || (batterySOC >= heaterSoc && powerBalance + heaterShare > heaterThreshold);
+    if (waterHeaterRequest) {
+      LOG_DEBUG("Water heater: ON (using excess power)");
     }
     
     gridPower = false;
@@ -227,256 +3238,1312 @@ void manageEnergy() {
   // ===== CASE 2: Deficit Power (Consumption > Generation) =====
   else {
     float deficit = abs(powerBalance);
-    Serial.println("MODE: Deficit - Using Battery/Grid");
+    LOG_DEBUG("MODE: Deficit - Using Battery/Grid");
     
-    // Try to use battery first
-    if (batterySOC > 20) {  // Keep 20% reserve
+    // Try to use battery first, keeping 20% reserve or whatever the plan
+    // saves for later hours
+    float dischargeFloor = 20;
+    if (planActive) {
+      dischargeFloor = max(dischargeFloor, planFloor);
+    }
+    if (!gridAvailable) {
+      dischargeFloor = 0;   // Islanded: the reserve is what is left, shedding guards the bottom
+    }
+    if (batterySOC > dischargeFloor) {
       float dischargeRate = min(deficit, maxBatteryPower);
-      float dischargeEfficiency = 0.90;  // 90% discharge efficiency
-      float energyUsed = (dischargeRate / (dischargeEfficiency * batteryCapacity)) * 100;
+      float energyUsed = (dischargeRate * hours / (DISCHARGE_EFFICIENCY * batteryCapacity)) * 100;  // % over dt
       
       batterySOC -= energyUsed;
       if (batterySOC < 0) batterySOC = 0;
       
       deficit -= dischargeRate;
-      Serial.printf("Discharging battery: -%.2f%% (%.1f W)\n", energyUsed, dischargeRate);
+      dischargePower = dischargeRate;
+      LOG_DEBUG("Discharging battery: -%.2f%% (%.1f W)", energyUsed, dischargeRate);
     }
     
     // If battery low or can't cover deficit, use grid
-    if (batterySOC <= 20 || deficit > 100) {
+    if (gridAvailable && (batterySOC <= 20 || deficit > 100)) {
       gridPower = true;
-      Serial.printf("Grid power: ON (covering %.1f W)\n", deficit);
+      gridImportPower = deficit;
+      LOG_DEBUG("Grid power: ON (covering %.1f W)", deficit);
     } else {
       gridPower = false;
     }
     
-    // Turn off water heater during deficit
-    waterHeater = false;
+    // Turn off water heater during deficit, unless a running heater is
+    // still inside its band (a planned one at any SOC, or it would cycle
+    // against the surplus branch)
+    bool heaterPlanned = planActive && (planStep & PLAN_WATER_HEATER);
+    waterHeaterRequest = waterHeater && (heaterPlanned || batterySOC >= heaterSoc) && powerBalance + heaterShare > heaterThreshold;
   }
   
-  // Load shedding if critical
-  if (batterySOC < 10 && gridPower == false) {
-    Serial.println("CRITICAL: Load shedding activated");
-    // Turn off non-essential loads
-    devices[1] = false;  // Heater
-    devices[4] = false;  // Washing machine
-    devices[5] = false;  // AC
+  // Load shedding if critical; held until the battery is back above SHED_EXIT_SOC
+  bool wasShedding = shedActive;
+  shedActive = batterySOC < (shedActive ? SHED_EXIT_SOC : SHED_ENTER_SOC) && gridPower == false;
+  if (shedActive) {
+    shedLoads();
+    if (!wasShedding) LOG_WARN("CRITICAL: Load shedding activated");
+  } else if (wasShedding) {
+    LOG_INFO("Load shedding cleared");
   }
   
+  integrateEnergy(dt, currentPvPower, totalLoad, chargePower, dischargePower, gridImportPower);
+  gridImportW = lroundf(gridImportPower);
+  
   systemEfficiency = calculateEfficiency();
-  Serial.printf("System Efficiency: %.1f%%\n", systemEfficiency);
-  Serial.println("============================\n");
+  LOG_DEBUG("System Efficiency: %.1f%%", systemEfficiency);
+  LOG_DEBUG("============================");
+}
+#else
+// ===== Energy Management Algorithm (fixed-point) =====
+void manageEnergy() {
+  BENCH_SCOPE(BENCH_MANAGE_ENERGY);
+  FxStep step;
+  step.dtUs = energyStepMicros();
+  if (rolloverDailyEnergy()) {
+    fxDaily = {};
+    resetSwitchCounters();
+  }
+  
+  bool fresh = predictionIsFresh();
+  currentPvPower = fresh ? predictedPvPower : fallbackPvPower();
+  totalLoad = ratedLoad(deviceState) + (waterHeater ? waterHeaterLoad : 0);
+  meterActive = applyMeterReading();
+#if EMS_TINY_MODEL
+  if (fresh || meterActive) observeForModel(currentPvPower, meterActive ? totalLoad : predictedConsumption);
+#endif
+#if EMS_FLEET
+  totalLoad += fleetPeerLoad();
+#endif
+  
+  // Float inputs are converted once at the boundary
+  step.pvMw = toMilliwatts(currentPvPower);
+  step.loadMw = toMilliwatts(totalLoad);
+  step.heaterMw = toMilliwatts(waterHeaterLoad);
+  step.heaterPlanned = planActive && (planStep & PLAN_WATER_HEATER);
+  step.heaterOn = waterHeater;
+  step.gridAvailable = gridAvailable;
+  step.shedActive = shedActive;
+  step.dischargeFloorUj = planActive ? (int64_t)lroundf(planFloor * 1000) * FX_UJ_PER_MILLI_PERCENT : 0;
+  
+  fxEnergyStep(step, fxBatteryUj);
+  fxIntegrate(step, fxDaily);
+  
+  bool wasShedding = shedActive;
+  gridPower = step.gridPower;
+  waterHeaterRequest = step.waterHeater;
+  shedActive = step.shedActive;
+  if (shedActive) {
+    shedLoads();
+  }
+  fxPvMw = step.pvMw;
+  fxLoadMw = step.loadMw;
+  gridImportW = step.gridImportMw / 1000;
+  
+  // Float views for the snapshot, web and uplink
+  totalLoad = step.loadMw / 1000.0;
+  batterySOC = fxBatterySOC();
+  systemEfficiency = fxEfficiency(step.loadMw, step.pvMw, gridPower) / 1000.0;
+  dailyEnergy.pvGeneration = uJToWh(fxDaily.pv);
+  dailyEnergy.consumption = uJToWh(fxDaily.load);
+  dailyEnergy.batteryCharge = uJToWh(fxDaily.charge);
+  dailyEnergy.batteryDischarge = uJToWh(fxDaily.discharge);
+  dailyEnergy.gridImport = uJToWh(fxDaily.grid);
+  
+  LOG_DEBUG("===== ENERGY MANAGEMENT =====");
+  LOG_DEBUG("PV Power: %.1f W", currentPvPower);
+  LOG_DEBUG("Total Load: %.1f W", totalLoad);
+  LOG_DEBUG("Battery SOC: %.3f%%", batterySOC);
+  if (meterActive) {
+    LOG_DEBUG("PV and load measured");
+  } else if (!fresh) {
+    LOG_DEBUG("Prediction stale - using clear-sky fallback");
+  }
+  if (step.chargeMw > 0) LOG_DEBUG("Charging battery: %ld mW", (long)step.chargeMw);
+  if (step.dischargeMw > 0) LOG_DEBUG("Discharging battery: %ld mW", (long)step.dischargeMw);
+  if (gridPower) LOG_DEBUG("Grid power: ON (covering %ld mW)", (long)step.gridImportMw);
+  if (waterHeaterRequest) LOG_DEBUG("Water heater: ON (using excess power)");
+  if (shedActive && !wasShedding) LOG_WARN("CRITICAL: Load shedding activated");
+  if (!shedActive && wasShedding) LOG_INFO("Load shedding cleared");
+  LOG_DEBUG("System Efficiency: %.1f%%", systemEfficiency);
+  LOG_DEBUG("============================");
+}
+#endif
+
+// ===== Load Dispatch =====
+// Comfort and deferrable circuits are switched by one rule: taken in
+// priority order (class, then table order), the longest run whose rated
+// loads fit the budget is on. The budget is supplyPower() minus the load
+// the dispatcher does not switch (critical and night circuits, the water
+// heater, unmetered extras, fleet peers), so a load's own draw never counts
+// against it. Loads already on are kept until the run overshoots the budget
+// by DISPATCH_RELEASE_MARGIN. The order holds only the circuits allowed to
+// run (SOC limits, shedding, the plan); its prefix sums and masks are
+// rebuilt when that set changes, so a tick is two binary searches.
+const int32_t DISPATCH_RELEASE_MARGIN = 200;   // W
+
+// Control loop only
+uint8_t dispatchOrder[DEVICE_COUNT];           // Device indexes, highest priority first
+int32_t dispatchPrefix[DEVICE_COUNT + 1];      // W of the first k
+DeviceMask dispatchPrefixMask[DEVICE_COUNT + 1];
+int dispatchCount = 0;
+DeviceMask dispatchEligible = ~(DeviceMask)0;  // Set the order was built for; never a real set
+
+#if EMS_FIXED_POINT
+bool socAbove(int percent) { return fxBatteryUj > fxSocEnergy(percent); }
+bool socBelow(int percent) { return fxBatteryUj < fxSocEnergy(percent); }
+int32_t supplyNow() { return supplyPower(fxPvMw / 1000, socAbove(BATTERY_DISPATCH_SOC), gridAvailable); }
+int32_t loadNow() { return fxLoadMw / 1000; }
+#else
+bool socAbove(int percent) { return batterySOC > percent; }
+bool socBelow(int percent) { return batterySOC < percent; }
+int32_t supplyNow() { return supplyPower(lroundf(currentPvPower), socAbove(BATTERY_DISPATCH_SOC), gridAvailable); }
+int32_t loadNow() { return lroundf(totalLoad); }
+#endif
+
+void buildDispatchOrder(DeviceMask eligible) {
+  dispatchCount = 0;
+  dispatchPrefix[0] = 0;
+  dispatchPrefixMask[0] = 0;
+  for (DeviceClass priority : {DEVICE_COMFORT, DEVICE_DEFERRABLE}) {
+    for (int i = 0; i < DEVICE_COUNT; i++) {
+      if (DEVICE_TABLE[i].priority != priority || !(eligible & deviceBit(i))) continue;
+      dispatchOrder[dispatchCount] = i;
+      dispatchPrefix[dispatchCount + 1] = dispatchPrefix[dispatchCount] + DEVICE_TABLE[i].load;
+      dispatchPrefixMask[dispatchCount + 1] = dispatchPrefixMask[dispatchCount] | deviceBit(i);
+      dispatchCount++;
+    }
+  }
+  dispatchEligible = eligible;
+}
+
+// Flexible circuits allowed to run this tick
+DeviceMask eligibleLoads() {
+  DeviceMask eligible = 0;
+  for (int i = 0; i < DEVICE_COUNT; i++) {
+    const DeviceDescriptor& device = DEVICE_TABLE[i];
+    if (!(FLEXIBLE_DEVICES & deviceBit(i))) continue;
+    if (device.offBelowSoc != 0 && socBelow(device.offBelowSoc)) continue;  // e.g. AC off when the battery is low
+    bool on = deviceOn(deviceState, i);
+    if (!on && device.minSocOn != 0 && !socAbove(device.minSocOn)) continue;
+    eligible |= deviceBit(i);
+  }
+  
+  // Nothing sheddable comes back until the battery has recovered
+  if (shedActive) eligible &= ~SHEDDABLE_DEVICES;
+  // The plan moves deferrable loads to hours that can power them without the grid
+  if (planActive && !(planStep & PLAN_DEFERRABLE)) eligible &= ~DEFERRABLE_DEVICES;
+  return eligible;
+}
+
+int32_t dispatchBudget() {
+  int32_t switched = ratedLoad(deviceState & FLEXIBLE_DEVICES);
+#if EMS_FLEET
+  // The coordinator's budget for this node already covers its own load
+  if (fleetView.role != FLEET_LOCAL) return lroundf(fleetView.budget) - ratedLoad(deviceState & ~FLEXIBLE_DEVICES) - (waterHeater ? waterHeaterLoad : 0);
+#endif
+  int32_t budget = supplyNow() - (loadNow() - switched - (waterHeater ? waterHeaterLoad : 0));
+  // Added load may all come from the grid, so the running flexible loads
+  // plus what is left under the peak limit is as far as it goes
+  return min(budget, switched + PEAK_IMPORT_LIMIT - gridImportW);
+}
+
+// Leading loads in the order that fit `budget`
+int dispatchFit(int32_t budget) {
+  return std::upper_bound(dispatchPrefix + 1, dispatchPrefix + dispatchCount + 1, budget) - (dispatchPrefix + 1);
+}
+
+DeviceMask dispatchLoads() {
+  DeviceMask eligible = eligibleLoads();
+  if (eligible != dispatchEligible) buildDispatchOrder(eligible);
+  
+  int32_t budget = dispatchBudget();
+  DeviceMask on = dispatchPrefixMask[dispatchFit(budget)];
+  DeviceMask keep = dispatchPrefixMask[dispatchFit(budget + DISPATCH_RELEASE_MARGIN)];
+  on |= deviceState & keep;
+  
+  // Dropped loads still run out their minOnTime in updateRelays(), so a
+  // washing cycle is not cut mid-run; only load shedding skips the dwell
+  return on;
 }
 
-// ===== Apply priority-based device control =====
 void applyDeviceControl() {
-  // Always-on devices
-  devices[0] = true;   // Fridge (critical)
-  devices[3] = true;   // Router (critical)
+  DeviceMask next = CRITICAL_DEVICES;
   
   // Lights based on time
-  devices[2] = !isDaytime();
+  if (!isDaytime()) next |= NIGHT_DEVICES;
+  
+  deviceRequest = next | dispatchLoads();
+}
+
+// ===== WiFi Link =====
+// WiFi comes up in the background: setup() only starts the connection, and
+// control runs from the first tick whether it succeeds or not. The AP's
+// BSSID and channel from the last connection are kept in NVS, so a reboot
+// joins without a scan; a static address (or WIFI_REUSE_LEASE) skips DHCP
+// too. A cached AP that does not answer within WIFI_CACHED_TIMEOUT is
+// forgotten and the next attempt scans. NTP starts and the first fetches
+// are queued when the link comes up. Runs on the networking side only.
+const unsigned long WIFI_POLL_INTERVAL = 100;
+const unsigned long WIFI_CACHED_TIMEOUT = 3000;   // Join with BSSID and channel
+const unsigned long WIFI_SCAN_TIMEOUT = 15000;    // Join after a full scan, then retry
+
+struct WifiLinkCache {
+  uint8_t bssid[6];
+  uint8_t channel;               // 0: nothing cached
+  uint32_t ip;                   // Last DHCP lease
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+Preferences wifiPrefs;
+WifiLinkCache wifiCache = {};
+bool wifiUp = false;
+bool wifiFromCache = false;
+unsigned long wifiAttemptAt = 0;
+bool timeStarted = false;
+bool timeSynced = false;
+
+void beginWifi() {
+  WiFi.disconnect();
+  wifiFromCache = wifiCache.channel != 0;
+  if (wifiFromCache) {
+    WiFi.begin(ssid, password, wifiCache.channel, wifiCache.bssid, true);
+  } else {
+    WiFi.begin(ssid, password);
+  }
+  wifiAttemptAt = millis();
+}
+
+void startWifi() {
+  wifiPrefs.begin("wifi", false);
+  if (wifiPrefs.getBytes("link", &wifiCache, sizeof(wifiCache)) != sizeof(wifiCache)) {
+    wifiCache = {};
+  }
+  
+  WiFi.persistent(false);         // The link cache is ours; no config write per begin()
+  WiFi.setAutoReconnect(false);   // Reconnects go through wifiTick()
+  WiFi.mode(WIFI_STA);
+  if ((uint32_t)STATIC_IP != 0) {
+    WiFi.config(STATIC_IP, STATIC_GATEWAY, STATIC_SUBNET, STATIC_DNS);
+  } else if (WIFI_REUSE_LEASE && wifiCache.ip != 0) {
+    WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+  }
+  beginWifi();
+  LOG_INFO("Connecting to WiFi%s", wifiFromCache ? " (cached AP)" : "");
+}
+
+// NVS is flash: only written when the AP or the lease changed
+void saveWifiCache() {
+  WifiLinkCache next = wifiCache;
+  memcpy(next.bssid, WiFi.BSSID(), sizeof(next.bssid));
+  next.channel = WiFi.channel();
+  if ((uint32_t)STATIC_IP == 0) {
+    next.ip = (uint32_t)WiFi.localIP();
+    next.gateway = (uint32_t)WiFi.gatewayIP();
+    next.subnet = (uint32_t)WiFi.subnetMask();
+    next.dns = (uint32_t)WiFi.dnsIP();
+  }
+  if (memcmp(&next, &wifiCache, sizeof(next)) == 0) return;
+  wifiCache = next;
+  wifiPrefs.putBytes("link", &wifiCache, sizeof(wifiCache));
+}
+
+void onLinkUp() {
+  unsigned long now = millis();
+  wifiUp = true;
+  LOG_INFO("WiFi connected in %lu ms (%s). Dashboard at: http://%s", now - wifiAttemptAt,
+           wifiFromCache ? "cached AP" : "scan", WiFi.localIP().toString().c_str());
+  saveWifiCache();
+  if (!timeStarted) {
+    initTime();
+    timeStarted = true;
+  }
   
-  // Smart control for other devices based on power availability
-  float availablePower = currentPvPower + (batterySOC > 30 ? maxBatteryPower : 0);
+  // Fetch now rather than after a backoff run up while offline
+  if (!fetchInFlight.load(std::memory_order_acquire)) nextFetchAt = now;
+  if (!forecastInFlight.load(std::memory_order_acquire)) nextForecastAt = now;
+}
+
+void wifiTick() {
+  if (!timeSynced && timeStarted) {
+    struct tm timeinfo;
+    if (getLocalTime(&timeinfo, 0)) {
+      timeSynced = true;
+      LOG_INFO("Time synchronized");
+    }
+  }
   
-  if (availablePower > totalLoad + 200) {
-    devices[1] = true;  // Heater
+  if (WiFi.status() == WL_CONNECTED) {
+    if (!wifiUp) onLinkUp();
+    return;
   }
   
-  if (availablePower > totalLoad + 500) {
-    devices[4] = true;  // Washing machine
+  unsigned long now = millis();
+  if (wifiUp) {
+    wifiUp = false;
+    uplinkHealthy.store(false, std::memory_order_relaxed);   // Status goes to the offline log meanwhile
+    LOG_WARN("WiFi lost, reconnecting");
+    beginWifi();
+    return;
   }
   
-  if (availablePower > totalLoad + 1200 && batterySOC > 50) {
-    devices[5] = true;  // AC
-  } else if (batterySOC < 30) {
-    devices[5] = false;  // Turn off AC if battery low
+  if (now - wifiAttemptAt < (wifiFromCache ? WIFI_CACHED_TIMEOUT : WIFI_SCAN_TIMEOUT)) return;
+  if (wifiFromCache) {
+    LOG_WARN("Cached AP did not answer, scanning");
+    wifiCache.channel = 0;
   }
+  uplinkHealthy.store(false, std::memory_order_relaxed);
+  beginWifi();
 }
 
-// ===== Update relay outputs =====
-void updateRelays() {
-  for (int i = 0; i < 6; i++) {
-    digitalWrite(relayPins[i], devices[i] ? HIGH : LOW);
+// ===== Cooperative Scheduler =====
+// Each task runs on its own period measured with millis(). nextRun advances
+// by whole periods, so a task keeps its phase even if one iteration runs late.
+struct ScheduledTask {
+  const char* name;
+  unsigned long period;
+  unsigned long offset;   // Delay before the first run
+  void (*run)();
+  unsigned long nextRun;
+};
+
+// Take over a new prediction once, when it actually arrives
+void applyPrediction(SnapshotBuffer<PredictionInput>& source, uint32_t& appliedVersion) {
+  PredictionInput input;
+  uint32_t version = source.read(input);
+  if (version == appliedVersion) return;
+  appliedVersion = version;
+  
+  predictedPvPower = input.pvPower;
+  predictedConsumption = input.consumption;
+  predictionReceivedAt = input.receivedAt;
+  havePrediction = true;
+#if EMS_PREDICTION_CACHE
+  cachePrediction(input.pvPower, input.consumption);
+#endif
+}
+
+#if EMS_MQTT
+uint32_t appliedMqttPredictionVersion = 0;
+#endif
+
+void applyPredictionInput() {
+  applyPrediction(predictionState, appliedPredictionVersion);
+#if EMS_MQTT
+  applyPrediction(mqttPredictionState, appliedMqttPredictionVersion);
+#endif
+}
+
+void publishControlState() {
+  ControlSnapshot state;
+  state.devices = deviceState;
+  memcpy(state.switchesToday, switchesToday, sizeof(state.switchesToday));
+  state.waterHeater = waterHeater;
+  state.gridPower = gridPower;
+  state.loadShedding = shedActive;
+  state.autoMode = autoMode;
+  state.predictionStale = !predictionIsFresh();
+  state.metered = meterActive;
+  state.predictionAge = havePrediction ? millis() - predictionReceivedAt : 0;
+  state.currentPvPower = currentPvPower;
+  state.totalLoad = totalLoad;
+  state.batterySOC = batterySOC;
+  state.systemEfficiency = systemEfficiency;
+  state.predictedPvPower = predictedPvPower;
+  state.predictedConsumption = predictedConsumption;
+  state.dailyEnergy = dailyEnergy;
+  controlState.publish(state);
+  publishStatusJson(state);
+}
+
+void controlTick() {
+  METRIC_SCOPE(METRIC_CONTROL_TICK);
+#if EMS_WATCHDOG
+  feedWatchdog();
+#endif
+  handleTrips();
+  applyPredictionInput();
+#if EMS_PREDICTION_CACHE
+  interpolatePrediction();
+#endif
+  updatePlanStep();
+#if EMS_FLEET
+  updateFleetView();
+#endif
+  
+  // Apply device control based on available power
+  if (autoMode) {
+    applyDeviceControl();
+  }
+
+  // Run energy management algorithm; a fleet follower leaves the battery
+  // to the coordinator
+#if EMS_FLEET
+  if (fleetView.role == FLEET_FOLLOWER) {
+    followFleet();
+  } else {
+    manageEnergy();
+  }
+#else
+  manageEnergy();
+#endif
+
+  // Update relay outputs; nothing sheddable closes during an overcurrent
+  if (overcurrentHold) shedLoads();
+  updateRelays();
+  
+  publishControlState();
+}
+
+void predictionTick() {
+#if EMS_MQTT
+  if (mqttCarriesPredictions()) return;   // Pushed by the broker, status goes there too
+#endif
+  if (!wifiUp || fetchInFlight.load(std::memory_order_acquire)) return;
+  if ((long)(millis() - nextFetchAt) < 0) return;
+#if EMS_SYNC_ENDPOINT
+  queueHttpJob(JOB_SYNC, fetchInFlight);   // Carries a follower's status too
+#else
+#if EMS_FLEET
+  if (fleetFollowing.load(std::memory_order_relaxed)) return;  // The coordinator fetches for the fleet
+#endif
+  queueHttpJob(JOB_FETCH_PREDICTIONS, fetchInFlight);
+#endif
+}
+
+void telemetryTick() {
+#if EMS_MQTT
+  if (mqttConnected.load(std::memory_order_relaxed)) return;
+#endif
+  if (!wifiUp) return;
+  queueHttpJob(JOB_SEND_STATUS, statusInFlight);
+}
+
+#if EMS_MQTT
+// Non-blocking handoff to the MQTT task; a full queue drops the job
+void mqttStateTick() {
+  if (!mqttConnected.load(std::memory_order_relaxed)) return;
+  MqttJob job;
+  job.type = MQTT_JOB_STATE;
+  xQueueSend(mqttOutbox, &job, 0);
+}
+
+void mqttSampleTick() {
+  if (!mqttConnected.load(std::memory_order_relaxed)) return;
+  ControlSnapshot state;
+  controlState.read(state);
+  MqttJob job;
+  job.type = MQTT_JOB_SAMPLE;
+  encodeTelemetry(state, job.record);
+  xQueueSend(mqttOutbox, &job, 0);
+}
+#endif
+
+#if EMS_LOOKAHEAD || EMS_PREDICTION_CACHE
+void forecastTick() {
+#if EMS_FLEET
+  if (fleetFollowing.load(std::memory_order_relaxed)) return;
+#endif
+  if (!wifiUp || forecastInFlight.load(std::memory_order_acquire)) return;
+  if ((long)(millis() - nextForecastAt) < 0) return;
+  queueHttpJob(JOB_FETCH_FORECAST, forecastInFlight);
+}
+#endif
+
+#if EMS_OFFLINE_LOG
+void offlineLogTick() {
+  queueOfflineRecord();
+}
+#endif
+
+// Ordered by priority: control is checked first on every pass. In dual-core
+// mode control has its own task and this table only drives networking.
+ScheduledTask tasks[] = {
+#if !EMS_DUAL_CORE
+  {"control", CONTROL_INTERVAL, 0, controlTick, 0},
+#endif
+  {"wifi", WIFI_POLL_INTERVAL, 0, wifiTick, 0},
+  {"predictions", FETCH_POLL_INTERVAL, 0, predictionTick, 0},
+#if !EMS_SYNC_ENDPOINT || EMS_PREDICTION_CACHE
+  // Sync carries status otherwise; with the cache it runs too rarely for that
+  {"telemetry", TELEMETRY_INTERVAL, TELEMETRY_OFFSET, telemetryTick, 0},
+#endif
+#if EMS_LOOKAHEAD || EMS_PREDICTION_CACHE
+  {"forecast", FETCH_POLL_INTERVAL, FETCH_POLL_INTERVAL / 2, forecastTick, 0},
+#endif
+#if EMS_OFFLINE_LOG
+  {"offline-log", TELEMETRY_INTERVAL, TELEMETRY_INTERVAL, offlineLogTick, 0},
+#endif
+#if EMS_MQTT
+  {"mqtt-state", MQTT_STATE_INTERVAL, 0, mqttStateTick, 0},
+  {"mqtt-sample", MQTT_SAMPLE_INTERVAL, MQTT_SAMPLE_INTERVAL, mqttSampleTick, 0},
+#endif
+};
+const int TASK_COUNT = sizeof(tasks) / sizeof(tasks[0]);
+
+void initScheduler() {
+  unsigned long now = millis();
+  for (int i = 0; i < TASK_COUNT; i++) {
+    tasks[i].nextRun = now + tasks[i].offset;
+  }
+}
+
+// Runs at most one due task per call so the web server is serviced in between
+void runScheduler() {
+  unsigned long now = millis();
+  for (int i = 0; i < TASK_COUNT; i++) {
+    ScheduledTask& task = tasks[i];
+    if ((long)(now - task.nextRun) < 0) continue;
+
+    task.nextRun += task.period;
+    // Skip missed slots instead of running a burst of catch-up ticks
+    if ((long)(now - task.nextRun) >= 0) {
+      unsigned long missed = (now - task.nextRun) / task.period + 1;
+      task.nextRun += missed * task.period;
+    }
+
+    task.run();
+    return;
+  }
+}
+
+// ===== Live Events (Server-Sent Events) =====
+// Browsers subscribe to /events. Once per control tick the state is
+// serialized a single time and the same frame is written to every
+// subscriber, so ten dashboards cost the same as one. Frames only carry
+// fields that changed; a new subscriber gets one full frame first.
+const int MAX_EVENT_CLIENTS = 4;
+const unsigned long EVENT_HEARTBEAT_INTERVAL = 15000;  // Detects dead subscribers
+const size_t EVENT_FRAME_SIZE = STATUS_JSON_SIZE + 8;  // "data: " + JSON + "\n\n"
+
+WiFiClient eventClients[MAX_EVENT_CLIENTS];
+ControlSnapshot lastEventState;
+uint32_t lastEventVersion = 0;
+unsigned long lastEventSentAt = 0;
+
+bool writeEvent(WiFiClient& client, const char* data, size_t len) {
+  if (!client.connected()) return false;
+  return client.write((const uint8_t*)data, len) == len;
+}
+
+// Serializes a frame into `frame` as "data: {...}\n\n" and returns its length
+size_t buildEventFrame(char* frame, size_t size, const ControlSnapshot& state, ControlSnapshot* previous) {
+  StaticJsonDocument<STATE_JSON_CAPACITY> doc;
+  writeStateJson(doc, state, previous);
+  if (doc.size() == 0) return 0;  // Nothing changed
+  
+  size_t json = measureJson(doc);
+  if (json + 8 > size) {
+    LOG_WARN("Event frame of %u bytes does not fit %u, skipped", (unsigned)(json + 8), (unsigned)size);
+    return 0;
+  }
+  size_t len = snprintf(frame, size, "data: ");
+  len += serializeJson(doc, frame + len, size - len - 2);
+  frame[len++] = '\n';
+  frame[len++] = '\n';
+  return len;
+}
+
+void handleEvents() {
+  int slot = -1;
+  for (int i = 0; i < MAX_EVENT_CLIENTS; i++) {
+    if (!eventClients[i].connected()) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    server.send(503, "text/plain", "Too many subscribers");
+    return;
+  }
+  
+  WiFiClient client = server.client();
+  client.setNoDelay(true);
+  client.print("HTTP/1.1 200 OK\r\n"
+               "Content-Type: text/event-stream\r\n"
+               "Cache-Control: no-cache\r\n"
+               "Connection: keep-alive\r\n\r\n"
+               "retry: 3000\n\n");
+  
+  // The first frame is the cached full status, no serialization needed
+  StatusJson status;
+  statusJson.read(status);
+  if (writeEvent(client, "data: ", 6) &&
+      writeEvent(client, status.json, status.length) &&
+      writeEvent(client, "\n\n", 2)) {
+    eventClients[slot] = client;
+  }
+}
+
+// Called from the networking context after every handleClient()
+void pumpEvents() {
+  uint32_t version = controlState.currentVersion();
+  bool heartbeatDue = millis() - lastEventSentAt >= EVENT_HEARTBEAT_INTERVAL;
+  if (version == lastEventVersion && !heartbeatDue) return;
+  
+  int subscribers = 0;
+  for (int i = 0; i < MAX_EVENT_CLIENTS; i++) {
+    if (eventClients[i].connected()) subscribers++;
+  }
+  
+  // Nobody listening: no frame or ping, but keep the baseline current so
+  // the first delta after a subscribe is relative to the full frame it got
+  if (subscribers == 0) {
+    if (version != lastEventVersion) lastEventVersion = controlState.read(lastEventState);
+    return;
+  }
+  
+  static char frame[EVENT_FRAME_SIZE];   // Networking context only
+  size_t len = 0;
+  if (version != lastEventVersion) {
+    ControlSnapshot state;
+    lastEventVersion = controlState.read(state);
+    len = buildEventFrame(frame, sizeof(frame), state, &lastEventState);
+  }
+  if (len == 0 && heartbeatDue) {
+    len = snprintf(frame, sizeof(frame), ": ping\n\n");
+  }
+  if (len == 0) return;
+  
+  lastEventSentAt = millis();
+  for (int i = 0; i < MAX_EVENT_CLIENTS; i++) {
+    if (eventClients[i].connected() && !writeEvent(eventClients[i], frame, len)) {
+      eventClients[i].stop();
+    }
+  }
+}
+
+// ===== History Store =====
+// Fixed-memory ring buffers of per-tick samples with rollup tiers:
+// 2 s raw for the last hour, 1 min for the last day, 15 min for the last
+// week (about 59 KB in total). Samples are recorded from the networking
+// context, the same context that serves /api/history, so the buffers
+// need no locking. Times are seconds since boot; /api/history converts
+// them to Unix time once NTP has synced.
+struct __attribute__((packed)) HistorySample {
+  uint32_t time;          // Seconds since boot, start of the bucket
+  uint16_t pvPower;       // W, average over the bucket
+  uint16_t load;          // W, average over the bucket
+  uint16_t batterySOC;    // 0.01 %, average over the bucket
+  uint8_t flags;          // TELEMETRY_GRID / TELEMETRY_WATER_HEATER if set at any point
+  uint32_t devices;       // Bit i set if DEVICE_TABLE[i] was on at any point
+};
+
+struct HistoryTier {
+  const char* name;
+  uint32_t resolution;    // Seconds per sample
+  HistorySample* samples;
+  size_t capacity;
+  size_t head = 0;        // Next write position
+  size_t count = 0;
+  // Accumulator for the bucket currently being filled
+  uint32_t bucket = 0;
+  uint32_t pvSum = 0;
+  uint32_t loadSum = 0;
+  uint32_t socSum = 0;
+  uint16_t sampleCount = 0;
+  uint8_t flags = 0;
+  DeviceMask devices = 0;
+};
+
+const size_t HISTORY_RAW_SAMPLES = 3600 / (CONTROL_INTERVAL / 1000);
+const size_t HISTORY_MINUTE_SAMPLES = 24 * 60;
+const size_t HISTORY_QUARTER_SAMPLES = 7 * 24 * 4;
+
+HistorySample historyRaw[HISTORY_RAW_SAMPLES];
+HistorySample historyMinute[HISTORY_MINUTE_SAMPLES];
+HistorySample historyQuarter[HISTORY_QUARTER_SAMPLES];
+
+HistoryTier historyTiers[] = {
+  {"raw", CONTROL_INTERVAL / 1000, historyRaw, HISTORY_RAW_SAMPLES},
+  {"1m", 60, historyMinute, HISTORY_MINUTE_SAMPLES},
+  {"15m", 900, historyQuarter, HISTORY_QUARTER_SAMPLES},
+};
+const int HISTORY_TIER_COUNT = sizeof(historyTiers) / sizeof(historyTiers[0]);
+
+uint32_t lastHistoryVersion = 0;
+
+// Oldest sample is index 0
+const HistorySample& historyAt(const HistoryTier& tier, size_t index) {
+  return tier.samples[(tier.head + tier.capacity - tier.count + index) % tier.capacity];
+}
+
+void flushHistoryBucket(HistoryTier& tier) {
+  if (tier.sampleCount == 0) return;
+  
+  HistorySample& out = tier.samples[tier.head];
+  out.time = tier.bucket * tier.resolution;
+  out.pvPower = tier.pvSum / tier.sampleCount;
+  out.load = tier.loadSum / tier.sampleCount;
+  out.batterySOC = tier.socSum / tier.sampleCount;
+  out.flags = tier.flags;
+  out.devices = tier.devices;
+  
+  tier.head = (tier.head + 1) % tier.capacity;
+  if (tier.count < tier.capacity) tier.count++;
+  
+  tier.pvSum = tier.loadSum = tier.socSum = 0;
+  tier.sampleCount = 0;
+  tier.flags = tier.devices = 0;
+}
+
+void addHistorySample(HistoryTier& tier, uint32_t time, const HistorySample& sample) {
+  uint32_t bucket = time / tier.resolution;
+  if (bucket != tier.bucket) {
+    flushHistoryBucket(tier);
+    tier.bucket = bucket;
+  }
+  tier.pvSum += sample.pvPower;
+  tier.loadSum += sample.load;
+  tier.socSum += sample.batterySOC;
+  tier.sampleCount++;
+  tier.flags |= sample.flags;
+  tier.devices |= sample.devices;
+}
+
+// Called from the networking context; records one sample per control tick
+void recordHistory() {
+  uint32_t version = controlState.currentVersion();
+  if (version == lastHistoryVersion) return;
+  
+  ControlSnapshot state;
+  lastHistoryVersion = controlState.read(state);
+  
+  HistorySample sample;
+  sample.pvPower = scaleToU16(state.currentPvPower, 1);
+  sample.load = scaleToU16(state.totalLoad, 1);
+  sample.batterySOC = scaleToU16(state.batterySOC, 100);
+  sample.flags = (state.gridPower ? TELEMETRY_GRID : 0) |
+                 (state.waterHeater ? TELEMETRY_WATER_HEATER : 0);
+  sample.devices = state.devices;
+  
+  uint32_t now = uptimeSeconds();
+  for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+    addHistorySample(historyTiers[i], now, sample);
+  }
+}
+
+#if EMS_DUAL_CORE
+// ===== Dual-Core Tasks =====
+// Control runs on a fixed period with vTaskDelayUntil, so a slow HTTP call
+// on the networking core can never delay a relay update.
+void controlTask(void* parameter) {
+  TickType_t lastWake = xTaskGetTickCount();
+  for (;;) {
+    controlTick();
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(CONTROL_INTERVAL));
+  }
+}
+
+void networkTask(void* parameter) {
+  for (;;) {
+    server.handleClient();
+    pumpEvents();
+    recordHistory();
+    runScheduler();
+    vTaskDelay(1);  // Let the idle task and WiFi stack run
   }
-  digitalWrite(waterHeaterPin, waterHeater ? HIGH : LOW);
 }
 
+void startTasks() {
+  xTaskCreatePinnedToCore(controlTask, "control", CONTROL_TASK_STACK, NULL,
+                          CONTROL_TASK_PRIORITY, NULL, CONTROL_CORE);
+  xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, NULL,
+                          NETWORK_TASK_PRIORITY, NULL, NETWORK_CORE);
+}
+#endif
+
+// ===== Chunked Responses =====
+// Collects output in a fixed buffer (on the caller's stack) and sends it with
+// chunked transfer encoding, so a page never has to exist in RAM as a whole.
+class ChunkedResponse {
+ public:
+  explicit ChunkedResponse(WebServer& web) : web(web) {}
+
+  void begin(int code, const char* contentType) {
+    web.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    web.send(code, contentType, "");
+  }
+
+  void print(const char* text) {
+    while (*text) {
+      if (used == sizeof(buffer)) flush();
+      buffer[used++] = *text++;
+    }
+  }
+
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer + used, sizeof(buffer) - used, format, args);
+    va_end(args);
+    if (len < 0) return;
+
+    if ((size_t)len >= sizeof(buffer) - used) {
+      // Did not fit: send what we have and format again into an empty buffer
+      flush();
+      va_start(args, format);
+      len = vsnprintf(buffer, sizeof(buffer), format, args);
+      va_end(args);
+      if (len < 0) return;
+      if ((size_t)len >= sizeof(buffer)) len = sizeof(buffer) - 1;
+    }
+    used += len;
+  }
+
+  void end() {
+    flush();
+    web.sendContent("");  // Zero-length chunk terminates the response
+  }
+
+ private:
+  void flush() {
+    if (used == 0) return;
+    web.sendContent(buffer, used);
+    used = 0;
+  }
+
+  WebServer& web;
+  char buffer[512];
+  size_t used = 0;
+};
+
 // ===== Web Interface - Dashboard =====
+// The interactive dashboard is a gzipped static asset generated from
+// dashboard.html by build_dashboard.py. Browsers cache it and afterwards
+// only poll /api/data; the ETag lets them revalidate with a 304.
 void handleRoot() {
-  String html = "<!DOCTYPE html><html><head>";
-  html += "<meta charset='UTF-8'>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
-  html += "<title>Smart House Energy Management</title>";
-  html += "<style>";
-  html += "body { font-family: Arial; margin: 20px; background: #f0f0f0; }";
-  html += ".container { max-width: 800px; margin: auto; background: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }";
-  html += "h1 { color: #2c3e50; border-bottom: 3px solid #3498db; padding-bottom: 10px; }";
-  html += ".status { display: grid; grid-template-columns: 1fr 1fr; gap: 15px; margin: 20px 0; }";
-  html += ".card { background: #ecf0f1; padding: 15px; border-radius: 8px; border-left: 4px solid #3498db; }";
-  html += ".card h3 { margin: 0 0 10px 0; color: #2c3e50; }";
-  html += ".value { font-size: 24px; font-weight: bold; color: #27ae60; }";
-  html += ".device { background: #fff; padding: 12px; margin: 8px 0; border-radius: 5px; display: flex; justify-content: space-between; align-items: center; box-shadow: 0 1px 3px rgba(0,0,0,0.1); }";
-  html += ".device-on { border-left: 4px solid #27ae60; }";
-  html += ".device-off { border-left: 4px solid #e74c3c; }";
-  html += ".badge { padding: 5px 10px; border-radius: 12px; font-size: 12px; font-weight: bold; }";
-  html += ".badge-on { background: #27ae60; color: white; }";
-  html += ".badge-off { background: #e74c3c; color: white; }";
-  html += ".refresh { background: #3498db; color: white; border: none; padding: 10px 20px; border-radius: 5px; cursor: pointer; margin-top: 10px; }";
-  html += ".refresh:hover { background: #2980b9; }";
-  html += "</style>";
-  html += "</head><body>";
-  
-  html += "<div class='container'>";
-  html += "<h1>🏠 Smart House Energy Management</h1>";
-  
-  // Status cards
-  html += "<div class='status'>";
+  BENCH_SCOPE(BENCH_HANDLE_ROOT);
+  METRIC_SCOPE(METRIC_HANDLE_ROOT);
+  server.sendHeader("ETag", DASHBOARD_ETAG);
+  server.sendHeader("Cache-Control", "public, max-age=3600");
   
-  html += "<div class='card'>";
-  html += "<h3>☀️ PV Power</h3>";
-  html += "<div class='value'>" + String(currentPvPower, 1) + " W</div>";
-  html += "</div>";
+  if (server.header("If-None-Match") == DASHBOARD_ETAG) {
+    server.send(304);
+    return;
+  }
   
-  html += "<div class='card'>";
-  html += "<h3>⚡ Consumption</h3>";
-  html += "<div class='value'>" + String(totalLoad, 1) + " W</div>";
-  html += "</div>";
+  server.sendHeader("Content-Encoding", "gzip");
+  server.send_P(200, "text/html", (const char*)DASHBOARD_GZ, DASHBOARD_GZ_LEN);
+}
+
+// ===== Web Interface - Static Status Page =====
+// Server-rendered fallback for clients without JavaScript
+const char DASHBOARD_HEAD[] PROGMEM = R"rawliteral(<!DOCTYPE html><html><head>
+<meta charset='UTF-8'>
+<meta name='viewport' content='width=device-width, initial-scale=1.0'>
+<title>Smart House Energy Management</title>
+<style>
+body { font-family: Arial; margin: 20px; background: #f0f0f0; }
+.container { max-width: 800px; margin: auto; background: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }
+h1 { color: #2c3e50; border-bottom: 3px solid #3498db; padding-bottom: 10px; }
+.status { display: grid; grid-template-columns: 1fr 1fr; gap: 15px; margin: 20px 0; }
+.card { background: #ecf0f1; padding: 15px; border-radius: 8px; border-left: 4px solid #3498db; }
+.card h3 { margin: 0 0 10px 0; color: #2c3e50; }
+.value { font-size: 24px; font-weight: bold; color: #27ae60; }
+.device { background: #fff; padding: 12px; margin: 8px 0; border-radius: 5px; display: flex; justify-content: space-between; align-items: center; box-shadow: 0 1px 3px rgba(0,0,0,0.1); }
+.device-on { border-left: 4px solid #27ae60; }
+.device-off { border-left: 4px solid #e74c3c; }
+.badge { padding: 5px 10px; border-radius: 12px; font-size: 12px; font-weight: bold; }
+.badge-on { background: #27ae60; color: white; }
+.badge-off { background: #e74c3c; color: white; }
+.refresh { background: #3498db; color: white; border: none; padding: 10px 20px; border-radius: 5px; cursor: pointer; margin-top: 10px; }
+.refresh:hover { background: #2980b9; }
+</style>
+</head><body>
+<div class='container'>
+<h1>🏠 Smart House Energy Management</h1>
+<div class='status'>
+)rawliteral";
+
+const char DASHBOARD_CARD[] PROGMEM =
+  "<div class='card'><h3>%s</h3><div class='value'>%s</div></div>\n";
+
+const char DASHBOARD_DEVICE[] PROGMEM =
+  "<div class='device device-%s'><span>%s (%.0f W)</span>"
+  "<span class='badge badge-%s'>%s</span></div>\n";
+
+const char DASHBOARD_FOOT[] PROGMEM =
+  "<button class='refresh' onclick='location.reload()'>🔄 Refresh</button>\n"
+  "</div>\n</body></html>";
+
+void sendDeviceRow(ChunkedResponse& page, const char* name, float load, bool on) {
+  page.printf(DASHBOARD_DEVICE, on ? "on" : "off", name, load, on ? "on" : "off", on ? "ON" : "OFF");
+}
+
+void handleStatusPage() {
+  ControlSnapshot state;
+  controlState.read(state);
   
-  html += "<div class='card'>";
-  html += "<h3>🔋 Battery</h3>";
-  html += "<div class='value'>" + String(batterySOC, 1) + " %</div>";
-  html += "</div>";
+  ChunkedResponse page(server);
+  char value[24];
   
-  html += "<div class='card'>";
-  html += "<h3>🔌 Grid</h3>";
-  html += "<div class='value'>" + String(gridPower ? "ON" : "OFF") + "</div>";
-  html += "</div>";
+  page.begin(200, "text/html");
+  page.print(DASHBOARD_HEAD);
   
-  html += "</div>";
+  // Status cards
+  snprintf(value, sizeof(value), "%.1f W", state.currentPvPower);
+  page.printf(DASHBOARD_CARD, "☀️ PV Power", value);
+  snprintf(value, sizeof(value), "%.1f W", state.totalLoad);
+  page.printf(DASHBOARD_CARD, "⚡ Consumption", value);
+  snprintf(value, sizeof(value), "%.1f %%", state.batterySOC);
+  page.printf(DASHBOARD_CARD, "🔋 Battery", value);
+  page.printf(DASHBOARD_CARD, "🔌 Grid", state.gridPower ? "ON" : "OFF");
+  page.print("</div>\n");
   
   // Devices
-  html += "<h2>Device Status</h2>";
-  for (int i = 0; i < 6; i++) {
-    html += "<div class='device " + String(devices[i] ? "device-on" : "device-off") + "'>";
-    html += "<span>" + String(deviceNames[i]) + " (" + String(deviceLoad[i], 0) + " W)</span>";
-    html += "<span class='badge " + String(devices[i] ? "badge-on" : "badge-off") + "'>" + String(devices[i] ? "ON" : "OFF") + "</span>";
-    html += "</div>";
+  page.print("<h2>Device Status</h2>\n");
+  for (int i = 0; i < DEVICE_COUNT; i++) {
+    sendDeviceRow(page, DEVICE_TABLE[i].name, DEVICE_TABLE[i].load, deviceOn(state.devices, i));
   }
-  
-  html += "<div class='device " + String(waterHeater ? "device-on" : "device-off") + "'>";
-  html += "<span>Water Heater (" + String(waterHeaterLoad, 0) + " W)</span>";
-  html += "<span class='badge " + String(waterHeater ? "badge-on" : "badge-off") + "'>" + String(waterHeater ? "ON" : "OFF") + "</span>";
-  html += "</div>";
+  sendDeviceRow(page, WATER_HEATER.name, WATER_HEATER.load, state.waterHeater);
   
   // System info
-  html += "<h2>System Information</h2>";
-  html += "<div class='card'>";
-  html += "<p><strong>System Efficiency:</strong> " + String(systemEfficiency, 1) + "%</p>";
-  html += "<p><strong>Mode:</strong> " + String(autoMode ? "Automatic" : "Manual") + "</p>";
-  html += "<p><strong>Predicted PV:</strong> " + String(predictedPvPower, 1) + " W</p>";
-  html += "<p><strong>Predicted Consumption:</strong> " + String(predictedConsumption, 1) + " W</p>";
-  html += "</div>";
+  page.print("<h2>System Information</h2>\n<div class='card'>\n");
+  page.printf("<p><strong>System Efficiency:</strong> %.1f%%</p>\n", state.systemEfficiency);
+  page.printf("<p><strong>Mode:</strong> %s</p>\n", state.autoMode ? "Automatic" : "Manual");
+  page.printf("<p><strong>Predicted PV:</strong> %.1f W</p>\n", state.predictedPvPower);
+  page.printf("<p><strong>Predicted Consumption:</strong> %.1f W</p>\n", state.predictedConsumption);
+  page.printf("<p><strong>Prediction Source:</strong> %s</p>\n",
+              state.predictionStale ? "Clear-sky fallback (stale)" : "API");
+  page.print("</div>\n");
+  
+  page.print(DASHBOARD_FOOT);
+  page.end();
+}
+
+// ===== History API =====
+// GET /api/history?from=&to=&res=
+//   from, to : Unix seconds once the clock is synced, otherwise seconds
+//              since boot (see "clock" in the response). Default: last hour.
+//   res      : raw, 1m or 15m (or seconds). Default: the finest tier that
+//              still reaches back to `from`.
+// Response: {"res":60,"clock":"unix","samples":[[t,pv,load,soc,grid,water_heater,devices],...]}
+void handleHistory() {
+  uint32_t now = uptimeSeconds();
+  uint32_t unixNow = unixTime();
+  uint32_t offset = unixNow ? unixNow - now : 0;  // Boot time in Unix seconds
+  
+  // Work in seconds since boot internally
+  uint32_t to = now;
+  uint32_t from = now > 3600 ? now - 3600 : 0;
+  if (server.hasArg("to")) {
+    uint32_t value = strtoul(server.arg("to").c_str(), NULL, 10);
+    to = value > offset ? value - offset : 0;
+  }
+  if (server.hasArg("from")) {
+    uint32_t value = strtoul(server.arg("from").c_str(), NULL, 10);
+    from = value > offset ? value - offset : 0;
+  }
+  
+  int tierIndex = -1;
+  if (server.hasArg("res")) {
+    String res = server.arg("res");
+    uint32_t seconds = strtoul(res.c_str(), NULL, 10);
+    for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+      if (res == historyTiers[i].name || (seconds > 0 && historyTiers[i].resolution >= seconds)) {
+        tierIndex = i;
+        break;
+      }
+    }
+    if (tierIndex < 0) {
+      server.send(400, "application/json", "{\"error\":\"res must be raw, 1m or 15m\"}");
+      return;
+    }
+  } else {
+    tierIndex = HISTORY_TIER_COUNT - 1;
+    for (int i = 0; i < HISTORY_TIER_COUNT; i++) {
+      const HistoryTier& tier = historyTiers[i];
+      bool full = tier.count == tier.capacity;
+      if (!full || (tier.count > 0 && historyAt(tier, 0).time <= from)) {
+        tierIndex = i;
+        break;
+      }
+    }
+  }
   
-  html += "<button class='refresh' onclick='location.reload()'>🔄 Refresh</button>";
-  html += "</div>";
+  const HistoryTier& tier = historyTiers[tierIndex];
+  ChunkedResponse body(server);
+  body.begin(200, "application/json");
+  body.printf("{\"res\":%lu,\"clock\":\"%s\",\"samples\":[",
+              (unsigned long)tier.resolution, offset ? "unix" : "uptime");
   
-  html += "</body></html>";
+  bool first = true;
+  for (size_t i = 0; i < tier.count; i++) {
+    const HistorySample& sample = historyAt(tier, i);
+    if (sample.time < from) continue;
+    if (sample.time > to) break;
+    body.printf("%s[%lu,%u,%u,%.2f,%d,%d,%lu]", first ? "" : ",",
+                (unsigned long)(sample.time + offset), sample.pvPower, sample.load,
+                sample.batterySOC / 100.0, (sample.flags & TELEMETRY_GRID) ? 1 : 0,
+                (sample.flags & TELEMETRY_WATER_HEATER) ? 1 : 0, (unsigned long)sample.devices);
+    first = false;
+  }
   
-  server.send(200, "text/html", html);
+  body.print("]}");
+  body.end();
 }
 
 // ===== API endpoint for JSON data =====
 void handleApiData() {
-  DynamicJsonDocument doc(1024);
+  BENCH_SCOPE(BENCH_HANDLE_API_DATA);
+  METRIC_SCOPE(METRIC_HANDLE_API_DATA);
+  // Already serialized by the control loop this tick
+  StatusJson status;
+  statusJson.read(status);
+  
+  // The generation doubles as an ETag, so a poll within the same tick is a 304
+  char etag[16];
+  snprintf(etag, sizeof(etag), "\"s%lu\"", (unsigned long)status.generation);
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  
+  if (server.header("If-None-Match") == etag) {
+    server.send(304);
+    return;
+  }
+  
+  // A RAM buffer: send() with a length, send_P is for flash
+  server.send(200, "application/json", (const uint8_t*)status.json, status.length);
+}
+
+#if EMS_BENCH
+// ===== Benchmark report =====
+// One JSON object per build so runs can be diffed between firmware versions
+void handleBench() {
+  ChunkedResponse out(server);
+  out.begin(200, "application/json");
+  out.printf("{\"build\":\"%s\",\"target\":\"%s\",\"alloc_count\":\"%s\",\"min_free_heap\":%u,\"probes\":[",
+             EMS_BUILD_ID, EMS_BENCH_TARGET, BENCH_ALLOC_COUNT, (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+  
+  uint32_t sorted[BENCH_SAMPLES];
+  for (int i = 0; i < BENCH_PROBES; i++) {
+    BenchStats& stats = benchStats[i];
+    uint32_t calls = stats.calls.load(std::memory_order_acquire);
+    int n = min(calls, (uint32_t)BENCH_SAMPLES);
+    memcpy(sorted, stats.samples, n * sizeof(uint32_t));
+    std::sort(sorted, sorted + n);
+    
+    uint32_t minFree = stats.minFreeHeap.load(std::memory_order_relaxed);
+    out.printf("%s{\"name\":\"%s\",\"calls\":%u,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u,"
+               "\"allocs_per_call\":%.2f,\"alloc_bytes_per_call\":%.1f,\"min_free_heap\":%u}",
+               i ? "," : "", BENCH_NAMES[i], (unsigned)calls,
+               (unsigned)(n ? sorted[(n - 1) * 50 / 100] : 0), (unsigned)(n ? sorted[(n - 1) * 99 / 100] : 0),
+               (unsigned)stats.maxUs.load(std::memory_order_relaxed),
+               calls ? (float)stats.allocs.load(std::memory_order_relaxed) / calls : 0.0f,
+               calls ? (float)stats.allocBytes.load(std::memory_order_relaxed) / calls : 0.0f,
+               (unsigned)(minFree == UINT32_MAX ? 0 : minFree));
+  }
+  
+  out.print("]}\n");
+  out.end();
+}
+#endif
+
+// ===== Metrics Endpoint =====
+// Prometheus text format. Only loads atomics and the published snapshot,
+// so a scrape never waits on the control loop.
+#if EMS_METRICS
+const char* const METRIC_TIMER_SERIES[METRIC_TIMERS] = {
+  "ems_control_tick_seconds",
+  "ems_http_handler_seconds{handler=\"/\"",
+  "ems_http_handler_seconds{handler=\"/api/data\"",
+  "ems_api_call_seconds{call=\"fetchPredictions\"",
+  "ems_api_call_seconds{call=\"sendStatusToDatabase\"",
+  "ems_api_call_seconds{call=\"syncWithServer\"",
+  "ems_api_call_seconds{call=\"fetchForecast\""
+};
+const char* const TRIP_REASONS[3] = {"grid_lost", "overcurrent", "watchdog"};
+
+// Series names above carry an open label set (or none) so bucket and
+// sum lines can add to it
+void writeHistogram(ChunkedResponse& out, const char* series, const LatencyHistogram& histogram) {
+  const char* labels = strchr(series, '{');
+  int nameLength = labels ? labels - series : strlen(series);
+  const char* separator = labels ? "," : "{";
+  labels = labels ? labels : "";
+  
+  uint32_t cumulative = 0;
+  for (int i = 0; i <= METRIC_BUCKET_COUNT; i++) {
+    cumulative += histogram.buckets[i].load(std::memory_order_relaxed);
+    if (i < METRIC_BUCKET_COUNT) {
+      out.printf("%.*s_bucket%s%sle=\"%g\"} %u\n", nameLength, series, labels, separator,
+                 METRIC_BUCKETS_US[i] / 1e6, (unsigned)cumulative);
+    } else {
+      out.printf("%.*s_bucket%s%sle=\"+Inf\"} %u\n", nameLength, series, labels, separator, (unsigned)cumulative);
+    }
+  }
+  const char* close = *labels ? "}" : "";
+  out.printf("%.*s_sum%s%s %.6f\n", nameLength, series, labels, close,
+             histogram.sumUs.load(std::memory_order_relaxed) / 1e6);
+  out.printf("%.*s_count%s%s %u\n", nameLength, series, labels, close, (unsigned)cumulative);
+}
+
+void handleMetrics() {
+  ControlSnapshot state;
+  controlState.read(state);
+  
+  ChunkedResponse out(server);
+  out.begin(200, "text/plain; version=0.0.4");
+  
+  out.print("# TYPE ems_control_tick_seconds histogram\n");
+  writeHistogram(out, METRIC_TIMER_SERIES[METRIC_CONTROL_TICK], metricTimers[METRIC_CONTROL_TICK]);
+  out.print("# TYPE ems_http_handler_seconds histogram\n");
+  writeHistogram(out, METRIC_TIMER_SERIES[METRIC_HANDLE_ROOT], metricTimers[METRIC_HANDLE_ROOT]);
+  writeHistogram(out, METRIC_TIMER_SERIES[METRIC_HANDLE_API_DATA], metricTimers[METRIC_HANDLE_API_DATA]);
+  out.print("# TYPE ems_api_call_seconds histogram\n");
+  for (int i = METRIC_FETCH_PREDICTIONS; i < METRIC_TIMERS; i++) {
+    writeHistogram(out, METRIC_TIMER_SERIES[i], metricTimers[i]);
+  }
+  out.print("# TYPE ems_api_call_failures_total counter\n");
+  for (int i = METRIC_FETCH_PREDICTIONS; i < METRIC_TIMERS; i++) {
+    out.printf("ems_api_call_failures_total%s} %u\n", strchr(METRIC_TIMER_SERIES[i], '{'),
+               (unsigned)metricTimers[i].failures.load(std::memory_order_relaxed));
+  }
+  
+  out.print("# TYPE ems_heap_free_bytes gauge\n");
+  out.printf("ems_heap_free_bytes %u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+  out.print("# TYPE ems_heap_min_free_bytes gauge\n");
+  out.printf("ems_heap_min_free_bytes %u\n", (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+  out.print("# TYPE ems_heap_largest_free_block_bytes gauge\n");
+  out.printf("ems_heap_largest_free_block_bytes %u\n", (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
   
-  doc["pv_power"] = currentPvPower;
-  doc["consumption"] = totalLoad;
-  doc["battery_soc"] = batterySOC;
-  doc["grid_power"] = gridPower;
-  doc["efficiency"] = systemEfficiency;
+  bool connected = WiFi.status() == WL_CONNECTED;
+  uint32_t connects = wifiConnects.load(std::memory_order_relaxed);
+  out.print("# TYPE ems_wifi_connected gauge\n");
+  out.printf("ems_wifi_connected %d\n", connected ? 1 : 0);
+  if (connected) {
+    out.print("# TYPE ems_wifi_rssi_dbm gauge\n");
+    out.printf("ems_wifi_rssi_dbm %d\n", (int)WiFi.RSSI());
+  }
+  out.print("# TYPE ems_wifi_reconnects_total counter\n");
+  out.printf("ems_wifi_reconnects_total %u\n", (unsigned)(connects ? connects - 1 : 0));
   
-  JsonArray devicesArray = doc.createNestedArray("devices");
-  for (int i = 0; i < 6; i++) {
-    JsonObject device = devicesArray.createNestedObject();
-    device["name"] = deviceNames[i];
-    device["status"] = devices[i];
-    device["power"] = devices[i] ? deviceLoad[i] : 0;
+  out.print("# TYPE ems_relay_switches_total counter\n");
+  for (int channel = 0; channel <= DEVICE_COUNT; channel++) {
+    const char* name = channel == DEVICE_COUNT ? WATER_HEATER.name : DEVICE_TABLE[channel].name;
+    out.printf("ems_relay_switches_total{device=\"%s\"} %u\n", name,
+               (unsigned)relaySwitchTotal[channel].load(std::memory_order_relaxed));
+  }
+  out.print("# TYPE ems_emergency_trips_total counter\n");
+  for (int i = 0; i < 3; i++) {
+    out.printf("ems_emergency_trips_total{reason=\"%s\"} %u\n", TRIP_REASONS[i],
+               (unsigned)tripTotal[i].load(std::memory_order_relaxed));
   }
   
-  String jsonString;
-  serializeJson(doc, jsonString);
+  out.print("# TYPE ems_log_dropped_total counter\n");
+  out.printf("ems_log_dropped_total %u\n", (unsigned)consoleOverruns.load(std::memory_order_relaxed));
   
-  server.send(200, "application/json", jsonString);
+  out.print("# TYPE ems_prediction_age_seconds gauge\n");
+  out.printf("ems_prediction_age_seconds %.1f\n", state.predictionAge / 1000.0);
+  out.print("# TYPE ems_prediction_stale gauge\n");
+  out.printf("ems_prediction_stale %d\n", state.predictionStale ? 1 : 0);
+  out.print("# TYPE ems_battery_soc_percent gauge\n");
+  out.printf("ems_battery_soc_percent %.2f\n", state.batterySOC);
+  out.print("# TYPE ems_pv_power_watts gauge\n");
+  out.printf("ems_pv_power_watts %.1f\n", state.currentPvPower);
+  out.print("# TYPE ems_load_watts gauge\n");
+  out.printf("ems_load_watts %.1f\n", state.totalLoad);
+  out.print("# TYPE ems_uptime_seconds counter\n");
+  out.printf("ems_uptime_seconds %llu\n", (unsigned long long)(esp_timer_get_time() / 1000000));
+  out.end();
 }
+#endif
 
 // ===== Setup =====
 void setup() {
   Serial.begin(115200);
-  delay(1000);
+  startConsole();
+#if EMS_BENCH
+  initBench();
+#endif
   
-  Serial.println("\n\n===== SMART HOUSE ENERGY MANAGEMENT SYSTEM =====");
+  LOG_INFO("===== SMART HOUSE ENERGY MANAGEMENT SYSTEM =====");
   
   // Initialize relay pins
-  for (int i = 0; i < 6; i++) {
-    pinMode(relayPins[i], OUTPUT);
-    digitalWrite(relayPins[i], LOW);
+  for (int i = 0; i < DEVICE_COUNT; i++) {
+    pinMode(DEVICE_TABLE[i].pin, OUTPUT);
+    digitalWrite(DEVICE_TABLE[i].pin, LOW);
   }
-  pinMode(waterHeaterPin, OUTPUT);
-  digitalWrite(waterHeaterPin, LOW);
+  pinMode(WATER_HEATER.pin, OUTPUT);
+  digitalWrite(WATER_HEATER.pin, LOW);
   
-  // Connect to WiFi
-  Serial.print("Connecting to WiFi");
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
-  }
-  Serial.println("\nWiFi Connected!");
-  Serial.print("IP Address: ");
-  Serial.println(WiFi.localIP());
+  // Protection comes up before anything that can block on the network
+#if EMS_FAST_PATH
+  startFastPath();
+#endif
+#if EMS_WATCHDOG
+  startWatchdog();
+#endif
   
-  // Initialize time
-  initTime();
+  // WiFi connects in the background; NTP and the first fetch wait for it
+#if EMS_METRICS
+  WiFi.onEvent(onWifiGotIp, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+#endif
+  startWifi();
+#if EMS_FLEET
+  startFleet();       // ESP-NOW only needs the radio started, not the link
+#endif
   
   // Setup web server
+  const char* headerKeys[] = {"If-None-Match"};
+  server.collectHeaders(headerKeys, 1);
   server.on("/", handleRoot);
+  server.on("/status", handleStatusPage);
   server.on("/api/data", handleApiData);
+  server.on("/events", handleEvents);
+  server.on("/api/history", handleHistory);
+#if EMS_METRICS
+  server.on("/metrics", handleMetrics);
+#endif
+#if EMS_BENCH
+  server.on("/api/bench", handleBench);
+#endif
   server.begin();
-  Serial.println("Web server started");
+  LOG_INFO("Web server started");
+  
+  // Predictions are fetched in the background; the first one is queued
+  // when the link is up and control uses the clear-sky fallback until then
+#if EMS_LOOKAHEAD
+  startPlanner();     // Waits for the first forecast
+#endif
+#if EMS_METERING
+  startMetering();
+#endif
+  initBootId();
+  startHttpWorker();
+#if EMS_MQTT
+  startMqtt();
+#endif
   
-  // Fetch initial predictions
-  fetchPredictions();
+  // Give the web server valid data before the first control tick
+#if EMS_FIXED_POINT
+  fxSetBatterySOC(batterySOC);
+#endif
+  publishControlState();
   
-  Serial.println("\nSystem ready!");
-  Serial.println("Access dashboard at: http://" + WiFi.localIP().toString());
+  initScheduler();
+#if EMS_DUAL_CORE
+  startTasks();
+#endif
+  
+  LOG_INFO("System ready, control running");
 }
 
 // ===== Main Loop =====
 void loop() {
-  // Handle web requests
+#if EMS_DUAL_CORE
+  // Control and networking run in their own pinned tasks
+  vTaskDelete(NULL);
+#else
+  // Handle web requests on every pass, no blocking delay
   server.handleClient();
+  pumpEvents();
+  recordHistory();
   
-  // Fetch predictions periodically
-  unsigned long currentMillis = millis();
-  if (currentMillis - lastApiCall >= API_INTERVAL) {
-    lastApiCall = currentMillis;
-    fetchPredictions();
-    sendStatusToDatabase();
-  }
-  
-  // Apply device control based on available power
-  if (autoMode) {
-    applyDeviceControl();
-  }
-  
-  // Run energy management algorithm
-  manageEnergy();
-  
-  // Update relay outputs
-  updateRelays();
-  
-  // Small delay
-  delay(2000);
+  // Run whichever periodic task is due
+  runScheduler();
+#endif
 }
@@ -7,12 +7,18 @@ Endpoints:
 - GET  /                      : Web dashboard
 - GET  /api/current           : Current data for ESP32
 - GET  /api/forecast          : 24-hour forecast
+- GET  /api/current_prediction: Prediction for the current hour (ESP32)
 - POST /api/update_device     : Update device status
+- POST /api/update_status     : ESP32 status, one sample or a batch
+- POST /api/sync              : ESP32 status in, current prediction out
+- POST /api/update_status_bin : Binary ESP32 telemetry records
 """
 
 from flask import Flask, jsonify, request, render_template_string
 from flask_cors import CORS
+from werkzeug.serving import WSGIRequestHandler
 import sqlite3
+import struct
 from datetime import datetime
 
 app = Flask(__name__)
@@ -20,14 +26,303 @@ CORS(app)
 
 DATABASE_PATH = 'smart_house.db'
 
+# ESP32 binary telemetry, must match TelemetryRecord in Ems_integrated.cpp:
+# version, flags, boot, reserved, device bitmask, time, PV W, load W,
+# SOC 0.01 %, efficiency 0.01 % (little-endian, 20 bytes)
+TELEMETRY_FORMAT = '<BBBxIIHHHH'
+TELEMETRY_SIZE = struct.calcsize(TELEMETRY_FORMAT)
+TELEMETRY_VERSION = 3
+# Version 2 (16 bytes, 8-bit device bitmask before boot), still sent by
+# devices running older firmware
+TELEMETRY_V2_FORMAT = '<BBBBIHHHH'
+TELEMETRY_V2_SIZE = struct.calcsize(TELEMETRY_V2_FORMAT)
+FLAG_GRID = 0x01
+FLAG_WATER_HEATER = 0x02
+FLAG_UPTIME = 0x10          # Time is seconds since boot: the clock was never set
+
+# Same order and ratings as DEVICE_TABLE (and WATER_HEATER) on the ESP32
+DEVICE_NAMES = ['Fridge', 'Heater', 'Light', 'Router', 'Washing', 'AC']
+DEVICE_LOADS = [150, 200, 100, 50, 500, 1200]
+WATER_HEATER_LOAD = 1500
+
+
+# One row per device and second; device_id is the reporting ESP32
+ENERGY_DATA_TABLE = '''CREATE TABLE IF NOT EXISTS {} (
+        id INTEGER PRIMARY KEY AUTOINCREMENT,
+        device_id TEXT NOT NULL DEFAULT '',
+        timestamp TEXT NOT NULL,
+        pv_power REAL,
+        consumption REAL,
+        battery_soc REAL,
+        grid_power INTEGER,
+        surplus REAL,
+        deficit REAL,
+        system_efficiency REAL,
+        created_at TEXT DEFAULT CURRENT_TIMESTAMP,
+        UNIQUE(device_id, timestamp)
+    );'''
+ENERGY_DATA_COLUMNS = ('timestamp, pv_power, consumption, battery_soc, grid_power, '
+                       'surplus, deficit, system_efficiency, created_at')
+
+# Tables the ESP32 endpoints write to, same schema as setup.py.
+# In device_status, device_id is the circuit index and node_id the ESP32.
+STATUS_SCHEMA = '''
+    CREATE TABLE IF NOT EXISTS current_data (
+        id INTEGER PRIMARY KEY,
+        timestamp TEXT,
+        pv_power REAL,
+        consumption REAL,
+        battery_soc REAL,
+        grid_power INTEGER,
+        system_efficiency REAL,
+        updated_at TEXT DEFAULT CURRENT_TIMESTAMP
+    );
+    {energy_data}
+    CREATE TABLE IF NOT EXISTS device_status (
+        id INTEGER PRIMARY KEY AUTOINCREMENT,
+        device_name TEXT NOT NULL,
+        device_id INTEGER,
+        status INTEGER,
+        power_consumption REAL,
+        timestamp TEXT NOT NULL,
+        created_at TEXT DEFAULT CURRENT_TIMESTAMP,
+        node_id TEXT NOT NULL DEFAULT ''
+    );
+    CREATE INDEX IF NOT EXISTS idx_energy_timestamp ON energy_data(timestamp);
+    CREATE INDEX IF NOT EXISTS idx_device_status_timestamp ON device_status(timestamp);
+    CREATE INDEX IF NOT EXISTS idx_device_time ON device_status(device_name, timestamp);
+    CREATE INDEX IF NOT EXISTS idx_device_status_node ON device_status(node_id, timestamp);
+'''.format(energy_data=ENERGY_DATA_TABLE.format('energy_data'))
+
+# Largest JSON batch accepted by /api/update_status
+MAX_STATUS_BATCH = 1000
+
+# Devices name themselves in this header (MAC or configured id)
+DEVICE_ID_HEADER = 'X-Device-Id'
+MAX_DEVICE_ID = 64
+
 
 def get_db():
     """الاتصال بقاعدة البيانات"""
-    conn = sqlite3.connect(DATABASE_PATH)
+    conn = sqlite3.connect(DATABASE_PATH, timeout=10)
     conn.row_factory = sqlite3.Row
+    # WAL is stored in the file; these two are per connection
+    conn.execute('PRAGMA synchronous = NORMAL')
+    conn.execute('PRAGMA busy_timeout = 5000')
     return conn
 
 
+def init_db():
+    """
+    WAL mode and indexes for the status tables
+    
+    Readers no longer block the writer and the writer no longer blocks
+    readers, so many devices posting every few seconds only queue behind
+    each other's short commits.
+    """
+    conn = sqlite3.connect(DATABASE_PATH)
+    conn.execute('PRAGMA journal_mode = WAL')
+    migrate_status_tables(conn)
+    conn.executescript(STATUS_SCHEMA)
+    conn.commit()
+    conn.close()
+
+
+def migrate_status_tables(conn):
+    """
+    Add device ids to status tables created before they existed
+    
+    energy_data was UNIQUE(timestamp), so it is rebuilt with the
+    (device_id, timestamp) key; rows already stored get device_id ''.
+    """
+    columns = {row[1] for row in conn.execute('PRAGMA table_info(energy_data)')}
+    if columns and 'device_id' not in columns:
+        conn.executescript(ENERGY_DATA_TABLE.format('energy_data_new') + f'''
+            INSERT INTO energy_data_new ({ENERGY_DATA_COLUMNS})
+                SELECT {ENERGY_DATA_COLUMNS} FROM energy_data;
+            DROP TABLE energy_data;
+            ALTER TABLE energy_data_new RENAME TO energy_data;
+        ''')
+    
+    columns = {row[1] for row in conn.execute('PRAGMA table_info(device_status)')}
+    if columns and 'node_id' not in columns:
+        conn.execute("ALTER TABLE device_status ADD COLUMN node_id TEXT NOT NULL DEFAULT ''")
+
+
+def decode_telemetry(body):
+    """
+    فك ترميز سجلات ESP32 الثنائية
+    
+    Returns:
+    --------
+    list of status dicts, same shape as the JSON the ESP32 sends.
+    Records the device could not put on Unix time (taken before NTP sync
+    in an earlier boot) have timestamp None and are not stored.
+    Each record's version byte picks its layout (3, or 2 from older firmware).
+    """
+    if len(body) == 0:
+        raise ValueError('Empty telemetry body')
+    
+    samples = []
+    at = 0
+    while at < len(body):
+        version = body[at]
+        if version == TELEMETRY_VERSION and at + TELEMETRY_SIZE <= len(body):
+            (_, flags, _, device_mask, record_time,
+             pv_power, load, soc, efficiency) = struct.unpack_from(TELEMETRY_FORMAT, body, at)
+            at += TELEMETRY_SIZE
+        elif version == 2 and at + TELEMETRY_V2_SIZE <= len(body):
+            (_, flags, device_mask, _, record_time,
+             pv_power, load, soc, efficiency) = struct.unpack_from(TELEMETRY_V2_FORMAT, body, at)
+            at += TELEMETRY_V2_SIZE
+        elif version in (2, TELEMETRY_VERSION):
+            raise ValueError(f'Truncated telemetry record at byte {at}')
+        else:
+            raise ValueError(f'Unsupported telemetry version {version}')
+        
+        synced = not (flags & FLAG_UPTIME)
+        when = datetime.fromtimestamp(record_time).strftime('%Y-%m-%d %H:%M:%S') if synced else None
+        devices = []
+        for i, name in enumerate(DEVICE_NAMES):
+            on = bool(device_mask & (1 << i))
+            devices.append({'name': name, 'status': on, 'power': DEVICE_LOADS[i] if on else 0})
+        
+        water_heater = bool(flags & FLAG_WATER_HEATER)
+        samples.append({
+            'timestamp': when,
+            'pv_power': float(pv_power),
+            'consumption': float(load),
+            'battery_soc': soc / 100.0,
+            'grid_power': bool(flags & FLAG_GRID),
+            'efficiency': efficiency / 100.0,
+            'water_heater': water_heater,
+            'water_heater_power': WATER_HEATER_LOAD if water_heater else 0,
+            'devices': devices
+        })
+    return samples
+
+
+def read_status_samples():
+    """
+    Status from the current request, binary or JSON
+    
+    JSON may be one sample, a list of samples or {"samples": [...]}.
+    Only a single sample may leave out its timestamp; it gets the
+    receive time. A batch without timestamps would collapse into one row.
+    """
+    if request.mimetype == 'application/octet-stream':
+        return decode_telemetry(request.get_data())
+    
+    data = request.get_json(force=True, silent=True)
+    if isinstance(data, dict) and isinstance(data.get('samples'), list):
+        data = data['samples']
+    samples = data if isinstance(data, list) else [data or {}]
+    if not samples:
+        raise ValueError('No samples')
+    if len(samples) > MAX_STATUS_BATCH:
+        raise ValueError(f'At most {MAX_STATUS_BATCH} samples per request')
+    
+    now = datetime.now().strftime('%Y-%m-%d %H:%M:%S')
+    for sample in samples:
+        if not isinstance(sample, dict):
+            raise ValueError('Samples must be JSON objects')
+        if 'timestamp' not in sample:
+            if len(samples) > 1:
+                raise ValueError('Every sample in a batch needs a timestamp')
+            sample['timestamp'] = now
+    return samples
+
+
+def request_device_id():
+    """Reporting device from the X-Device-Id header, '' when it is not sent"""
+    device_id = request.headers.get(DEVICE_ID_HEADER, '').strip()
+    if len(device_id) > MAX_DEVICE_ID:
+        raise ValueError(f'{DEVICE_ID_HEADER} is longer than {MAX_DEVICE_ID} characters')
+    return device_id
+
+
+def store_status_samples(cursor, samples, device_id=''):
+    """
+    حفظ عينات حالة من ESP32
+    
+    One executemany per table, so a batch costs the same number of
+    statements as a single sample. Rows are keyed on (device_id,
+    timestamp); a sample's own "device_id" overrides the request's,
+    so a gateway can batch several devices. The caller commits.
+    
+    Returns:
+    --------
+    number of samples stored; unsynced ones (timestamp None) are skipped
+    """
+    energy_rows = []
+    device_rows = []
+    for sample in samples:
+        if sample['timestamp'] is None:
+            continue
+        node_id = str(sample.get('device_id') or device_id)
+        pv_power = float(sample.get('pv_power', 0))
+        consumption = float(sample.get('consumption', 0))
+        energy_rows.append((
+            node_id, sample['timestamp'], pv_power, consumption,
+            float(sample.get('battery_soc', 70)),
+            int(bool(sample.get('grid_power', False))),
+            max(pv_power - consumption, 0), max(consumption - pv_power, 0),
+            float(sample.get('efficiency', 0))
+        ))
+        for circuit, device in enumerate(sample.get('devices', [])):
+            device_rows.append((device.get('name'), circuit, int(bool(device.get('status'))),
+                                device.get('power', 0), sample['timestamp'], node_id))
+    if not energy_rows:
+        return 0
+    
+    cursor.executemany('''
+        INSERT OR REPLACE INTO energy_data
+            (device_id, timestamp, pv_power, consumption, battery_soc, grid_power, surplus, deficit, system_efficiency)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
+    ''', energy_rows)
+    cursor.executemany('''
+        INSERT INTO device_status (device_name, device_id, status, power_consumption, timestamp, node_id)
+        VALUES (?, ?, ?, ?, ?, ?)
+    ''', device_rows)
+    
+    # Replayed offline records are older than the live state; keep the newest
+    newest = max(energy_rows, key=lambda row: row[1])
+    _, timestamp, pv_power, consumption, battery_soc, grid_power, _, _, efficiency = newest
+    cursor.execute('SELECT timestamp FROM current_data WHERE id = 1')
+    current = cursor.fetchone()
+    if current is None or current[0] is None or current[0] <= timestamp:
+        cursor.execute('''
+            INSERT OR REPLACE INTO current_data
+                (id, timestamp, pv_power, consumption, battery_soc, grid_power, system_efficiency)
+            VALUES (1, ?, ?, ?, ?, ?, ?)
+        ''', (timestamp, pv_power, consumption, battery_soc, grid_power, efficiency))
+    return len(energy_rows)
+
+
+def current_prediction(cursor):
+    """
+    أقرب توقع للساعة الحالية, in the format the ESP32 parses
+    
+    No battery SOC: each device measures its own, and current_data holds
+    whichever device reported last.
+    """
+    timestamp = datetime.now().strftime('%Y-%m-%d %H:%M:%S')
+    cursor.execute('''
+        SELECT timestamp, pv_power, consumption
+        FROM predictions
+        WHERE timestamp <= ?
+        ORDER BY timestamp DESC
+        LIMIT 1
+    ''', (timestamp,))
+    row = cursor.fetchone()
+    
+    return {
+        'timestamp': row['timestamp'] if row else timestamp,
+        'pv_power': float(row['pv_power']) if row else 0.0,
+        'consumption': float(row['consumption']) if row else 0.0
+    }
+
+
 @app.route('/')
 def dashboard():
     """لوحة التحكم على الويب"""
@@ -315,25 +610,31 @@ def get_forecast():
     
     Returns:
     --------
-    JSON: Array of predictions
+    JSON: Array of predictions from the current hour on, oldest first.
+    "time" is the row's Unix time; "timestamp" is server-local.
     """
     try:
         conn = get_db()
         cursor = conn.cursor()
         
+        # predictions only grows, so start at the current hour
+        hour_start = datetime.now().replace(minute=0, second=0, microsecond=0)
         cursor.execute('''
             SELECT timestamp, pv_power, consumption, surplus, deficit
             FROM predictions
+            WHERE timestamp >= ?
             ORDER BY timestamp ASC
             LIMIT 24
-        ''')
+        ''', (hour_start.strftime('%Y-%m-%d %H:%M:%S'),))
         
         rows = cursor.fetchall()
         conn.close()
         
         forecast = []
         for row in rows:
+            when = datetime.strptime(row['timestamp'][:19], '%Y-%m-%d %H:%M:%S')
             forecast.append({
+                'time': int(when.timestamp()),
                 'timestamp': row['timestamp'],
                 'pv_power': float(row['pv_power']),
                 'consumption': float(row['consumption']),
@@ -387,6 +688,125 @@ def update_device():
         return jsonify({'error': str(e)}), 500
 
 
+@app.route('/api/sync', methods=['POST'])
+def sync_device():
+    """
+    مزامنة ESP32: حفظ الحالة وإرجاع التوقع الحالي في طلب واحد
+    
+    Body:
+    -----
+    Same JSON the ESP32 sends to /api/update_status, or binary
+    telemetry records (application/octet-stream)
+    
+    Returns:
+    --------
+    JSON:
+        {
+            "timestamp": "2026-02-15 20:00:00",
+            "pv_power": 2500.0,
+            "consumption": 1800.0
+        }
+    """
+    try:
+        samples = read_status_samples()
+        
+        conn = get_db()
+        cursor = conn.cursor()
+        
+        store_status_samples(cursor, samples, request_device_id())
+        prediction = current_prediction(cursor)
+        
+        conn.commit()
+        conn.close()
+        
+        return jsonify(prediction)
+        
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    except Exception as e:
+        return jsonify({'error': str(e)}), 500
+
+
+@app.route('/api/update_status_bin', methods=['POST'])
+def update_status_binary():
+    """
+    استقبال سجلات ESP32 الثنائية
+    
+    Body:
+    -----
+    One or more 20-byte telemetry records (application/octet-stream)
+    """
+    try:
+        samples = decode_telemetry(request.get_data())
+        
+        conn = get_db()
+        cursor = conn.cursor()
+        stored = store_status_samples(cursor, samples, request_device_id())
+        conn.commit()
+        conn.close()
+        
+        return jsonify({'status': 'success', 'records': stored, 'unsynced': len(samples) - stored})
+        
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    except Exception as e:
+        return jsonify({'error': str(e)}), 500
+
+
+@app.route('/api/update_status', methods=['POST'])
+def update_status():
+    """
+    استقبال حالة ESP32
+    
+    Body:
+    -----
+    One status sample as JSON, a batch as a JSON list (or
+    {"samples": [...]}), or binary telemetry records. A batch is
+    written in one transaction.
+    """
+    try:
+        samples = read_status_samples()
+        
+        conn = get_db()
+        cursor = conn.cursor()
+        stored = store_status_samples(cursor, samples, request_device_id())
+        conn.commit()
+        conn.close()
+        
+        return jsonify({'status': 'success', 'records': stored, 'unsynced': len(samples) - stored})
+        
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    except Exception as e:
+        return jsonify({'error': str(e)}), 500
+
+
+@app.route('/api/current_prediction', methods=['GET'])
+def get_current_prediction():
+    """
+    التوقع الحالي للـ ESP32
+    
+    Returns:
+    --------
+    JSON:
+        {
+            "timestamp": "2026-02-15 20:00:00",
+            "pv_power": 2500.0,
+            "consumption": 1800.0
+        }
+    """
+    try:
+        conn = get_db()
+        cursor = conn.cursor()
+        prediction = current_prediction(cursor)
+        conn.close()
+        
+        return jsonify(prediction)
+        
+    except Exception as e:
+        return jsonify({'error': str(e)}), 500
+
+
 @app.route('/api/devices', methods=['GET'])
 def get_devices():
     """الحصول على حالة جميع الأجهزة"""
@@ -460,8 +880,15 @@ if __name__ == '__main__':
     print("  Forecast:         http://localhost:5000/api/forecast")
     print("  Devices:          http://localhost:5000/api/devices")
     print("  Statistics:       http://localhost:5000/api/stats")
+    print("  ESP32 Sync:       http://localhost:5000/api/sync")
+    print("  ESP32 Status:     http://localhost:5000/api/update_status")
+    print("  ESP32 Prediction: http://localhost:5000/api/current_prediction")
     print("\nESP32 Configuration:")
     print("  API_SERVER = \"http://YOUR_IP:5000\"")
     print("="*70 + "\n")
     
+    init_db()
+    
+    # HTTP/1.1 keeps the ESP32's connection open between requests
+    WSGIRequestHandler.protocol_version = "HTTP/1.1"
     app.run(host='0.0.0.0', port=5000, debug=True)
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""
+Dashboard Asset Builder
+=======================
+Compresses dashboard.html and writes it as a byte array the ESP32
+firmware serves directly from flash (dashboard_gz.h).
+
+Run this after every change to dashboard.html:
+    python build_dashboard.py
+"""
+
+import gzip
+import zlib
+
+SOURCE_PATH = 'dashboard.html'
+HEADER_PATH = 'dashboard_gz.h'
+BYTES_PER_LINE = 16
+
+
+def build_header(html_bytes):
+    """Return the C header text for the gzipped page"""
+    # mtime=0 keeps the output (and the ETag) identical across rebuilds
+    compressed = gzip.compress(html_bytes, compresslevel=9, mtime=0)
+    etag = '%08x' % (zlib.crc32(compressed) & 0xffffffff)
+
+    lines = [
+        '// Generated by build_dashboard.py from dashboard.html - do not edit.',
+        '#pragma once',
+        '',
+        '#include <pgmspace.h>',
+        '',
+        'const char DASHBOARD_ETAG[] = "\\"%s\\"";' % etag,
+        'const size_t DASHBOARD_GZ_LEN = %d;' % len(compressed),
+        'const uint8_t DASHBOARD_GZ[] PROGMEM = {',
+    ]
+    for i in range(0, len(compressed), BYTES_PER_LINE):
+        chunk = compressed[i:i + BYTES_PER_LINE]
+        lines.append('  ' + ', '.join('0x%02x' % b for b in chunk) + ',')
+    lines.append('};')
+    lines.append('')
+
+    return '\n'.join(lines), len(compressed), etag
+
+
+def main():
+    with open(SOURCE_PATH, 'rb') as f:
+        html_bytes = f.read()
+
+    header, size, etag = build_header(html_bytes)
+
+    with open(HEADER_PATH, 'w') as f:
+        f.write(header)
+
+    print(f"✓ {SOURCE_PATH}: {len(html_bytes)} bytes → {size} bytes gzipped")
+    print(f"✓ Wrote {HEADER_PATH} (ETag {etag})")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,125 @@
+// Generated by build_dashboard.py from dashboard.html - do not edit.
+#pragma once
+
+#include <pgmspace.h>
+
+const char DASHBOARD_ETAG[] = "\"2da02a7c\"";
+const size_t DASHBOARD_GZ_LEN = 1850;
+const uint8_t DASHBOARD_GZ[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0x58, 0xdd, 0x72, 0xdb, 0xb8,
+  0x15, 0xbe, 0xd7, 0x53, 0x9c, 0xcd, 0x6e, 0x87, 0xd4, 0x44, 0xbf, 0x76, 0xd2, 0xb8, 0xb2, 0xa4,
+  0x4e, 0xd6, 0x71, 0x9a, 0x74, 0x9c, 0xb5, 0xa7, 0x4e, 0x37, 0xd3, 0x2b, 0x0f, 0x44, 0x82, 0x12,
+  0x62, 0x0a, 0xe0, 0x00, 0xa0, 0x64, 0xd5, 0xeb, 0x99, 0xde, 0xb7, 0x33, 0x7b, 0xd3, 0x8b, 0x4e,
+  0x6f, 0xb6, 0x7d, 0x8b, 0x3e, 0x4f, 0x5f, 0xa0, 0xfb, 0x08, 0x3d, 0x07, 0x00, 0x69, 0x4a, 0x96,
+  0xbd, 0xb1, 0xc6, 0x22, 0x09, 0xe0, 0x7c, 0xe7, 0xff, 0x03, 0xa8, 0xf1, 0x57, 0x6f, 0xce, 0x4f,
+  0x3e, 0xfe, 0xe9, 0xe2, 0x14, 0x16, 0x76, 0x99, 0x4f, 0xc7, 0xe1, 0x9b, 0xb3, 0x74, 0xda, 0x1a,
+  0x2f, 0xb9, 0x65, 0x90, 0x2c, 0x98, 0x36, 0xdc, 0x4e, 0xa2, 0x3f, 0x7e, 0x7c, 0xdb, 0x3d, 0x8a,
+  0xaa, 0x61, 0xc9, 0x96, 0x7c, 0x12, 0xad, 0x04, 0x5f, 0x17, 0x4a, 0xdb, 0x08, 0x12, 0x25, 0x2d,
+  0x97, 0xb8, 0x6c, 0x2d, 0x52, 0xbb, 0x98, 0xa4, 0x7c, 0x25, 0x12, 0xde, 0x75, 0x0f, 0x1d, 0x10,
+  0x52, 0x58, 0xc1, 0xf2, 0xae, 0x49, 0x58, 0xce, 0x27, 0xc3, 0xde, 0x80, 0x60, 0xac, 0xb0, 0x39,
+  0x9f, 0x5e, 0x2e, 0x99, 0xb6, 0xf0, 0x4e, 0x95, 0x86, 0xc3, 0xa9, 0xe4, 0x7a, 0xbe, 0x81, 0x0f,
+  0x4c, 0xb2, 0x39, 0x5f, 0x22, 0xda, 0xb8, 0xef, 0x17, 0xb5, 0xc6, 0xc6, 0x6e, 0xe8, 0x3a, 0x53,
+  0xe9, 0x06, 0x6e, 0x21, 0x43, 0x65, 0xdd, 0x8c, 0x2d, 0x45, 0xbe, 0x19, 0xc1, 0x6b, 0x8d, 0xd0,
+  0xc7, 0x80, 0x38, 0x73, 0x21, 0x47, 0x70, 0x30, 0x28, 0x6e, 0x8e, 0x61, 0xc6, 0x92, 0xeb, 0xb9,
+  0x56, 0xa5, 0x4c, 0x47, 0xf0, 0x75, 0x36, 0xa0, 0xcf, 0x31, 0xdc, 0xb5, 0x7a, 0x64, 0x26, 0x13,
+  0xa8, 0x07, 0x51, 0x96, 0xec, 0xc6, 0x1b, 0x38, 0x82, 0xa3, 0x81, 0x93, 0xaa, 0x30, 0x58, 0x69,
+  0xd5, 0x36, 0xc6, 0x7a, 0x21, 0x2c, 0x3f, 0x86, 0x82, 0xa5, 0xa9, 0x90, 0xf3, 0x5a, 0x8b, 0xd2,
+  0x29, 0xd7, 0x5d, 0xcd, 0x52, 0x51, 0x9a, 0x11, 0x0c, 0xc3, 0xe0, 0x4d, 0xd7, 0x2c, 0x58, 0xaa,
+  0xd6, 0x23, 0x18, 0xc0, 0x41, 0x71, 0xe3, 0xc6, 0x41, 0xcf, 0x67, 0x2c, 0x1e, 0x74, 0xdc, 0xa7,
+  0x37, 0x6c, 0x93, 0x35, 0x8b, 0x21, 0x5a, 0x91, 0xa8, 0x5c, 0x69, 0x34, 0xf2, 0x20, 0x39, 0xe4,
+  0x2f, 0x07, 0x35, 0xe6, 0x4c, 0x59, 0xab, 0x96, 0x23, 0x38, 0x44, 0x51, 0xa3, 0x72, 0x91, 0xc2,
+  0xd7, 0x87, 0x2f, 0x7e, 0x73, 0x94, 0xce, 0x6a, 0x23, 0xea, 0x25, 0x5e, 0x2d, 0x3a, 0x67, 0x2c,
+  0xb3, 0xa5, 0x41, 0xcc, 0x54, 0x98, 0x22, 0x67, 0x18, 0x9b, 0xb9, 0x16, 0xe9, 0xb1, 0xfb, 0xee,
+  0x5a, 0xbe, 0xc4, 0x31, 0xcb, 0xbb, 0xa8, 0xb0, 0x5c, 0x4a, 0x32, 0x37, 0xd3, 0xf4, 0x8f, 0xf3,
+  0xac, 0xc0, 0xa7, 0x97, 0xcd, 0x08, 0x90, 0x7f, 0x10, 0x42, 0xc6, 0x74, 0x8a, 0x98, 0x5b, 0x11,
+  0xe5, 0x09, 0x46, 0x74, 0xd8, 0x88, 0x87, 0x97, 0xde, 0x89, 0xc7, 0x51, 0x63, 0x2c, 0xe7, 0x99,
+  0x1d, 0xc1, 0x8b, 0x87, 0xde, 0x54, 0x1a, 0x16, 0x87, 0x2e, 0x25, 0x5e, 0xfd, 0x00, 0x3f, 0xc3,
+  0x60, 0xc2, 0x6e, 0x80, 0x50, 0x60, 0xc5, 0xf2, 0x92, 0x57, 0x75, 0x60, 0xc4, 0x9f, 0x39, 0x1a,
+  0xfc, 0x82, 0x94, 0xb9, 0x81, 0x35, 0x17, 0xf3, 0x05, 0x2a, 0x9b, 0xa9, 0x3c, 0x6d, 0x88, 0xbf,
+  0x62, 0xfc, 0xd7, 0x5e, 0xdc, 0x17, 0xe7, 0xae, 0x4f, 0x59, 0x96, 0x35, 0x1d, 0x3a, 0x68, 0x86,
+  0xe3, 0xc8, 0x9b, 0xb2, 0xe3, 0x9f, 0xf3, 0xb9, 0x8e, 0x75, 0x96, 0x73, 0x7c, 0xfc, 0x5c, 0x1a,
+  0x2b, 0xb2, 0x4d, 0x37, 0xf4, 0xc3, 0x08, 0x4c, 0xc1, 0xb0, 0x11, 0x66, 0xdc, 0xae, 0x39, 0x97,
+  0xc7, 0xc0, 0x72, 0x31, 0x97, 0x5d, 0x2c, 0xa6, 0x25, 0x02, 0x24, 0xb8, 0x82, 0xeb, 0xdd, 0x92,
+  0x19, 0xa2, 0xb2, 0xc3, 0xfd, 0x15, 0x13, 0x4c, 0xef, 0x2a, 0x49, 0xd6, 0x3f, 0x12, 0xd9, 0x07,
+  0x9e, 0x76, 0x55, 0x96, 0x3d, 0xb1, 0x9e, 0xbf, 0x7a, 0x91, 0x1c, 0x26, 0x6e, 0xfd, 0x8c, 0xa5,
+  0x73, 0x0a, 0x4c, 0x1d, 0x86, 0x97, 0xa1, 0x7c, 0x1f, 0xd6, 0xfa, 0x41, 0x1d, 0x6f, 0x9f, 0x80,
+  0xc6, 0xc0, 0x76, 0x02, 0x2a, 0xd8, 0x60, 0x74, 0x33, 0xe4, 0x95, 0xa5, 0x21, 0x47, 0xa1, 0xc9,
+  0xee, 0x05, 0xbc, 0xd9, 0x5b, 0x85, 0x17, 0x6c, 0x7d, 0x20, 0x51, 0x16, 0x29, 0x16, 0x77, 0xda,
+  0x68, 0xa8, 0x57, 0xd9, 0x51, 0x72, 0x94, 0xee, 0xb1, 0xd1, 0x27, 0xb5, 0x6b, 0x55, 0x71, 0xdf,
+  0x3b, 0xe3, 0x7e, 0x60, 0x98, 0x71, 0xdf, 0x91, 0xdf, 0x98, 0x98, 0x06, 0x9f, 0x52, 0xb1, 0x82,
+  0x24, 0x67, 0xc6, 0x4c, 0xa2, 0x9a, 0x3a, 0x88, 0xbc, 0x16, 0xc3, 0xe9, 0xcf, 0x3f, 0xfd, 0xf8,
+  0x2f, 0xf8, 0x05, 0xfa, 0xc2, 0x65, 0x5b, 0x18, 0xbe, 0x43, 0xa3, 0x1d, 0x60, 0x2c, 0xff, 0x08,
+  0x49, 0xf7, 0x70, 0xfa, 0xdf, 0x7f, 0xfc, 0xe5, 0x7f, 0xff, 0xf9, 0x11, 0x2e, 0xbe, 0x87, 0x0b,
+  0xb5, 0xe6, 0x1a, 0xe5, 0x0f, 0xa7, 0xcd, 0x95, 0xae, 0xee, 0x23, 0x10, 0xe9, 0x24, 0x2a, 0x56,
+  0xd1, 0xb4, 0x3b, 0xee, 0xe3, 0xe4, 0xd4, 0x7f, 0x3f, 0x06, 0xf9, 0xcf, 0x7f, 0xc3, 0x89, 0x92,
+  0xa6, 0x5c, 0x16, 0x56, 0x28, 0xf9, 0x14, 0x64, 0xae, 0x58, 0xfa, 0x65, 0xa0, 0x3f, 0xff, 0xf4,
+  0xf7, 0xbf, 0xc2, 0xb7, 0xcc, 0x62, 0xf1, 0x6e, 0x9e, 0x42, 0x34, 0x2a, 0xf9, 0x62, 0xc0, 0xbf,
+  0xc1, 0xef, 0x90, 0xa6, 0x9e, 0x42, 0x23, 0x1a, 0x7b, 0x00, 0x17, 0x2e, 0x8b, 0x83, 0xe9, 0x1b,
+  0xdf, 0xd5, 0x97, 0x2e, 0xc4, 0x88, 0x73, 0x10, 0x94, 0x91, 0xa8, 0xef, 0x03, 0x0c, 0x7c, 0x63,
+  0xfd, 0xe5, 0xc6, 0x60, 0x17, 0xc2, 0x7b, 0x99, 0x29, 0xbd, 0x64, 0x21, 0x38, 0x07, 0xfb, 0x2c,
+  0x6c, 0x8d, 0x8b, 0x29, 0xee, 0x40, 0x5a, 0xc9, 0x79, 0x25, 0x75, 0x9a, 0x65, 0x22, 0x11, 0x5c,
+  0x26, 0x9b, 0x11, 0x95, 0x8e, 0x9b, 0x82, 0x31, 0xf6, 0xba, 0x74, 0xfa, 0x78, 0x96, 0x39, 0x4b,
+  0x69, 0x00, 0x75, 0x16, 0x5b, 0x10, 0x1f, 0x54, 0xca, 0xf7, 0x4a, 0x2d, 0x71, 0xe2, 0x71, 0xb1,
+  0x0b, 0xcd, 0x53, 0x91, 0x50, 0x8d, 0x5f, 0x7c, 0xbf, 0x57, 0xbc, 0x08, 0x35, 0xf1, 0x0b, 0xd2,
+  0x8d, 0x6a, 0xd8, 0x0f, 0x53, 0xd7, 0xc1, 0x53, 0x40, 0x28, 0x0d, 0x97, 0xaa, 0xd4, 0xc9, 0x7e,
+  0x57, 0x8c, 0x9b, 0xda, 0x45, 0x79, 0x58, 0x02, 0xa1, 0x6d, 0x7d, 0x82, 0xab, 0x87, 0x3a, 0x4b,
+  0x52, 0x99, 0x44, 0x8b, 0xc2, 0x4e, 0x49, 0x3f, 0x83, 0x85, 0xe6, 0xd9, 0x24, 0xea, 0x57, 0x4d,
+  0x44, 0x99, 0x16, 0x09, 0x84, 0x5d, 0xaf, 0xc0, 0xa6, 0x1b, 0xf7, 0x99, 0xd3, 0x34, 0xee, 0xd7,
+  0x92, 0xb5, 0xd2, 0xea, 0x19, 0xdb, 0xd8, 0x58, 0xf8, 0x06, 0x26, 0xa8, 0x12, 0x26, 0x53, 0x48,
+  0x55, 0x52, 0x52, 0xb3, 0xf6, 0xe6, 0xdc, 0x9e, 0xe6, 0xae, 0x6f, 0xbf, 0xdd, 0xbc, 0x4f, 0x63,
+  0x91, 0xb6, 0x8f, 0x5b, 0xad, 0xac, 0x94, 0xde, 0x57, 0x5f, 0x41, 0x7f, 0x50, 0xeb, 0x98, 0x4e,
+  0x3e, 0x1d, 0x50, 0xb2, 0x03, 0x05, 0x35, 0x69, 0x1b, 0x6e, 0x5b, 0x00, 0x1e, 0xd5, 0x20, 0x2a,
+  0xae, 0xfd, 0x2d, 0x44, 0x4a, 0x46, 0x30, 0xc2, 0x0b, 0xd6, 0xc1, 0x31, 0x4e, 0x6b, 0x6e, 0x4b,
+  0x2d, 0xe1, 0x59, 0xd3, 0xf5, 0xb0, 0x0b, 0x05, 0x8a, 0x7e, 0x06, 0xcf, 0x51, 0xfc, 0x39, 0x3c,
+  0x43, 0xef, 0x5d, 0xc4, 0x68, 0x80, 0x54, 0xe1, 0x25, 0x82, 0x38, 0xc2, 0x8b, 0x53, 0xd7, 0xb3,
+  0xea, 0xad, 0xb8, 0xe1, 0x69, 0x3c, 0x68, 0xd3, 0x6a, 0xf8, 0xd4, 0x0e, 0x11, 0xc6, 0xf5, 0xa8,
+  0x28, 0xfc, 0x3d, 0xf3, 0x99, 0x08, 0x9a, 0x3c, 0xab, 0x7b, 0x4e, 0x6d, 0xe8, 0xa1, 0xdb, 0xd8,
+  0x9b, 0x7b, 0xfe, 0x9d, 0x33, 0xf7, 0xfc, 0xed, 0xdb, 0x88, 0x60, 0xa3, 0x3a, 0x6b, 0x14, 0x3b,
+  0xf4, 0xe0, 0xae, 0xd5, 0xea, 0xf7, 0xe1, 0x74, 0x85, 0xc1, 0x81, 0x4c, 0xa3, 0x55, 0x06, 0xfd,
+  0xcc, 0x37, 0x80, 0xfd, 0xa1, 0x37, 0x74, 0x44, 0x94, 0x73, 0xac, 0xac, 0x4c, 0xf0, 0x3c, 0x35,
+  0x1d, 0xdc, 0x57, 0xe0, 0x9a, 0xf3, 0x02, 0xec, 0x82, 0xc3, 0x12, 0x39, 0x11, 0xa7, 0x28, 0x49,
+  0x1c, 0x16, 0x5c, 0xf3, 0x90, 0x00, 0x3f, 0x30, 0x81, 0xdb, 0xbb, 0x66, 0x94, 0x35, 0x97, 0xb8,
+  0xc9, 0xc4, 0xa9, 0x0f, 0xea, 0xf9, 0xec, 0x33, 0x4f, 0x6c, 0x0f, 0x7d, 0xc0, 0x3d, 0x33, 0x76,
+  0x12, 0x1d, 0xa0, 0xb4, 0x00, 0x88, 0x0c, 0xfc, 0x40, 0xaf, 0x58, 0x5d, 0xb9, 0xc0, 0xc0, 0x64,
+  0x32, 0x01, 0xdc, 0x24, 0x78, 0x86, 0x1c, 0x9d, 0xc2, 0x0f, 0x3f, 0xc0, 0x57, 0x7e, 0x41, 0xe8,
+  0xfd, 0x76, 0x48, 0x02, 0x49, 0x7f, 0x13, 0x13, 0x7f, 0xb6, 0x7b, 0x96, 0xdf, 0xd8, 0x13, 0xbf,
+  0x51, 0xa3, 0x29, 0xdb, 0x78, 0x75, 0xa0, 0x87, 0x2e, 0x22, 0xf0, 0x29, 0x0a, 0x92, 0xae, 0x3d,
+  0xf6, 0xcb, 0x26, 0xf7, 0xad, 0xf5, 0xa8, 0x38, 0x71, 0xe2, 0x7e, 0xe9, 0x99, 0x27, 0xd4, 0x2b,
+  0x5c, 0xb1, 0x2b, 0xfd, 0xab, 0x4a, 0xda, 0x71, 0xe0, 0x7e, 0x71, 0x9a, 0x0a, 0xa1, 0xd8, 0xce,
+  0x68, 0x10, 0x25, 0x4e, 0xda, 0x2f, 0xc9, 0x6b, 0x32, 0xdb, 0xd1, 0x5b, 0xab, 0x75, 0xcc, 0xb4,
+  0x5f, 0x98, 0xce, 0xca, 0x57, 0x34, 0x4f, 0x5a, 0x5f, 0xe3, 0x03, 0x71, 0x69, 0xe2, 0x94, 0xe3,
+  0x4e, 0x58, 0xb2, 0xbc, 0xc2, 0x28, 0x1e, 0x0f, 0x79, 0xc5, 0x4d, 0x57, 0xc5, 0xea, 0xd1, 0xb8,
+  0x15, 0x4f, 0xc4, 0xfd, 0x1e, 0xe0, 0xcb, 0x32, 0xe0, 0xb8, 0xe9, 0x49, 0x28, 0x94, 0xbf, 0xc2,
+  0x81, 0xdc, 0x79, 0x75, 0x92, 0x73, 0xa6, 0xbb, 0xe6, 0x7a, 0x03, 0x19, 0xcb, 0x73, 0x3a, 0x8f,
+  0xb8, 0xe2, 0xcb, 0x79, 0xdb, 0xb9, 0xf9, 0xfa, 0xe2, 0xbd, 0x83, 0xce, 0xb9, 0x75, 0x6f, 0x51,
+  0x88, 0x15, 0xb9, 0x01, 0xdc, 0x58, 0x20, 0xf6, 0xe5, 0x8e, 0x45, 0x08, 0x2a, 0x83, 0x9d, 0x8a,
+  0x74, 0xab, 0x9f, 0x4f, 0x1a, 0xe4, 0x82, 0x77, 0x3d, 0x4f, 0x30, 0x74, 0xe7, 0xa9, 0xcd, 0xdf,
+  0x7b, 0xb2, 0x21, 0xd8, 0x87, 0x52, 0xd1, 0x27, 0x84, 0xd5, 0xf0, 0x8e, 0xd3, 0x25, 0xea, 0x04,
+  0x35, 0x6b, 0x7a, 0xba, 0x5a, 0xb8, 0xc1, 0x7d, 0x63, 0x57, 0xf7, 0x90, 0x18, 0x95, 0x6a, 0x8b,
+  0x6c, 0xf7, 0x84, 0xc4, 0x83, 0xcc, 0xbb, 0x8f, 0x1f, 0xce, 0xd0, 0x11, 0xd2, 0x15, 0x16, 0x54,
+  0xec, 0xbc, 0x1b, 0xb7, 0xe8, 0x8c, 0xa1, 0x83, 0x61, 0x16, 0xc3, 0x41, 0xbc, 0xc5, 0xd7, 0xf0,
+  0x06, 0x1f, 0x63, 0x5c, 0xab, 0xce, 0x14, 0xbd, 0xf5, 0x7d, 0x14, 0x4b, 0x7e, 0x69, 0x35, 0x1e,
+  0x2a, 0xe3, 0xb6, 0xe3, 0x13, 0x66, 0x36, 0x32, 0x81, 0xba, 0xf3, 0x0b, 0x95, 0xe7, 0xb1, 0x6f,
+  0x7b, 0x8b, 0x94, 0x72, 0xeb, 0xb8, 0xcc, 0xc7, 0x4e, 0x73, 0xe2, 0x55, 0xb6, 0x66, 0x02, 0xc9,
+  0x87, 0xdb, 0x64, 0x11, 0x47, 0x7d, 0x56, 0x88, 0x3e, 0x2a, 0x64, 0xe8, 0x2c, 0x9e, 0xf8, 0x58,
+  0xb2, 0xc0, 0xd3, 0x5d, 0x24, 0x55, 0xd7, 0xdd, 0x46, 0x70, 0xe7, 0xbc, 0xf2, 0x34, 0x81, 0xe2,
+  0x3d, 0x75, 0xdd, 0xae, 0xb8, 0xc5, 0xe3, 0xd0, 0xe0, 0x67, 0xa3, 0x64, 0xdc, 0x76, 0x2b, 0xef,
+  0x10, 0x03, 0x81, 0x21, 0xe6, 0xed, 0xa0, 0xfa, 0x29, 0x87, 0xf1, 0x56, 0x72, 0x6f, 0x76, 0xae,
+  0x8c, 0xed, 0x10, 0xb3, 0xe8, 0x0d, 0xba, 0xd6, 0xeb, 0xf5, 0x5c, 0xe2, 0xef, 0x02, 0x61, 0x9e,
+  0x89, 0x15, 0x87, 0xa2, 0x34, 0x0b, 0x24, 0x4d, 0xb5, 0x84, 0x3e, 0x27, 0x02, 0x35, 0xc7, 0xae,
+  0x8c, 0xdc, 0xb9, 0x16, 0xac, 0x72, 0x9e, 0xa3, 0x2c, 0xd9, 0x4a, 0x84, 0x39, 0xd3, 0x6a, 0x6d,
+  0x30, 0x99, 0x58, 0x3b, 0xf8, 0x48, 0x28, 0x61, 0xa3, 0x88, 0x49, 0xc8, 0x94, 0x33, 0xda, 0xc8,
+  0x66, 0xb8, 0xc0, 0xe4, 0xca, 0x1a, 0xb0, 0xec, 0x9a, 0xcb, 0x36, 0x9a, 0x2f, 0x23, 0x0b, 0x85,
+  0x56, 0x2b, 0x81, 0x9d, 0x28, 0x6c, 0x8b, 0x8a, 0x91, 0x90, 0x29, 0xee, 0xc8, 0x8d, 0x20, 0xcb,
+  0x1c, 0x13, 0x59, 0x87, 0x1b, 0xab, 0x41, 0xdb, 0x0b, 0xaf, 0x39, 0x84, 0x9d, 0x62, 0x55, 0x4b,
+  0x34, 0xd9, 0xd2, 0xa7, 0xa6, 0xba, 0xab, 0x00, 0x0d, 0xb7, 0xef, 0xe9, 0xed, 0x05, 0x0f, 0x68,
+  0x4e, 0xac, 0x03, 0x2f, 0x07, 0x83, 0x81, 0xcf, 0x2d, 0x41, 0xad, 0x85, 0xc4, 0xf7, 0x99, 0x9e,
+  0xdb, 0x33, 0xfc, 0x41, 0xa1, 0xb9, 0x53, 0xfa, 0x48, 0x90, 0x5d, 0x58, 0x2a, 0x8d, 0x35, 0x98,
+  0x5a, 0x3f, 0x15, 0x39, 0x85, 0xfe, 0xbe, 0xa7, 0x24, 0xee, 0x38, 0x06, 0x37, 0x78, 0x14, 0xe0,
+  0xb4, 0x69, 0x87, 0x5c, 0xfe, 0xfe, 0xf2, 0xfc, 0xbb, 0x5e, 0x41, 0xbf, 0x4f, 0xc4, 0xd8, 0x55,
+  0x58, 0x0e, 0xed, 0x6d, 0x29, 0xae, 0xb5, 0x22, 0x5b, 0xd1, 0x43, 0x14, 0xba, 0xad, 0x4b, 0x22,
+  0x2c, 0xd0, 0x78, 0xd2, 0xdf, 0x5c, 0xfa, 0x8d, 0x08, 0x37, 0x8f, 0x86, 0x19, 0xbd, 0x93, 0xb3,
+  0xf3, 0xcb, 0xd3, 0x37, 0xed, 0x9d, 0x38, 0xb9, 0xdc, 0xa2, 0x87, 0xc0, 0x73, 0x3c, 0xef, 0x13,
+  0xde, 0xee, 0xbc, 0x7b, 0x93, 0xa8, 0x4f, 0x1e, 0xee, 0x25, 0x02, 0x4f, 0x95, 0xf4, 0xa3, 0x4a,
+  0xeb, 0xff, 0x88, 0xb2, 0x8c, 0x5d, 0x6b, 0x11, 0x00, 0x00,
+};
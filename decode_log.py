@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Binary Log Decoder
+==================
+Turns the ESP32's binary log records (built with EMS_LOG_BINARY=1) back
+into text lines.
+
+A record carries a hash of its format string instead of the string. The
+decoder finds every LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG call in the
+firmware source, hashes its format the same way (FNV-1a) and formats the
+record's arguments with it. Bytes outside records (boot ROM output, a
+record cut off by a reset) are skipped.
+
+    python decode_log.py capture.bin
+    python decode_log.py --port /dev/ttyUSB0          # needs pyserial
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+SOURCE_PATH = 'Ems_integrated.cpp'
+
+LOG_SYNC = 0xA5
+HEADER = struct.Struct('<BBBII')    # sync, length, level, format hash, millis
+LEVELS = {1: 'E', 2: 'W', 3: 'I', 4: 'D'}
+
+CALL = re.compile(r'\bLOG_(?:ERROR|WARN|INFO|DEBUG)\(\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+ESCAPES = {'n': '\n', 't': '\t', 'r': '\r', '"': '"', '\\': '\\', "'": "'", '0': '\0'}
+# C length modifiers Python's % operator does not know
+LENGTH = re.compile(r'(%[-+ #0]*(?:\*|\d+)?(?:\.(?:\*|\d+))?)(?:hh|h|ll|l|z|j|t)([diouxXeEfgGcs])')
+
+
+def fnv1a(data):
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def unescape(text):
+    return re.sub(r'\\(.)', lambda m: ESCAPES.get(m.group(1), m.group(1)), text)
+
+
+def load_formats(path):
+    """Format hash -> Python format string, from every log call in the source"""
+    with open(path, encoding='utf-8') as f:
+        source = f.read()
+
+    formats = {}
+    for match in CALL.finditer(source):
+        text = ''.join(unescape(part) for part in LITERAL.findall(match.group(1)))
+        formats[fnv1a(text.encode('utf-8'))] = LENGTH.sub(r'\1\2', text)
+    return formats
+
+
+def read_arguments(payload):
+    """Tagged arguments: 'i' int32, 'I' int64, 'f' float, 's' length + bytes"""
+    args = []
+    at = 0
+    while at < len(payload):
+        tag = chr(payload[at])
+        at += 1
+        if tag == 'i':
+            args.append(struct.unpack_from('<i', payload, at)[0])
+            at += 4
+        elif tag == 'I':
+            args.append(struct.unpack_from('<q', payload, at)[0])
+            at += 8
+        elif tag == 'f':
+            args.append(struct.unpack_from('<f', payload, at)[0])
+            at += 4
+        elif tag == 's':
+            length = payload[at]
+            args.append(payload[at + 1:at + 1 + length].decode('utf-8', 'replace'))
+            at += 1 + length
+        else:
+            raise ValueError(f'unknown argument tag {tag!r}')
+    return args
+
+
+def format_record(formats, level, format_hash, millis, payload):
+    stamp = f'[{millis / 1000:10.3f}] {LEVELS.get(level, "?")}'
+    template = formats.get(format_hash)
+    if template is None:
+        return f'{stamp} <unknown format {format_hash:08x}, {len(payload)} bytes>'
+    args = read_arguments(payload)
+    try:
+        return f'{stamp} {template % tuple(args)}'
+    except (TypeError, ValueError):
+        return f'{stamp} {template} {args}'
+
+
+def decode(stream, formats, out, follow=False):
+    """Decode records from a byte stream until it ends (or forever with follow)"""
+    buffer = bytearray()
+    decoded = skipped = 0
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            if follow:
+                continue
+            break
+        buffer += chunk
+
+        at = 0
+        while True:
+            start = buffer.find(bytes([LOG_SYNC]), at)
+            if start < 0:
+                skipped += len(buffer) - at
+                at = len(buffer)
+                break
+            skipped += start - at
+            if start + HEADER.size > len(buffer):
+                at = start
+                break
+            _, length, level, format_hash, millis = HEADER.unpack_from(buffer, start)
+            end = start + HEADER.size + length
+            if end > len(buffer):
+                at = start
+                break
+            # A sync byte inside other output: the hash will not match
+            if level not in LEVELS or format_hash not in formats:
+                at = start + 1
+                skipped += 1
+                continue
+            try:
+                line = format_record(formats, level, format_hash, millis, bytes(buffer[start + HEADER.size:end]))
+            except (ValueError, struct.error, IndexError):
+                at = start + 1
+                skipped += 1
+                continue
+            out.write(line + '\n')
+            decoded += 1
+            at = end
+        del buffer[:at]
+    return decoded, skipped
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode ESP32 binary log records')
+    parser.add_argument('capture', nargs='?', help='Raw serial capture (default: stdin)')
+    parser.add_argument('--port', help='Read from a serial port instead')
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument('--source', default=SOURCE_PATH)
+    args = parser.parse_args()
+
+    formats = load_formats(args.source)
+    if args.port:
+        import serial
+        stream = serial.Serial(args.port, args.baud, timeout=1)
+    elif args.capture:
+        stream = open(args.capture, 'rb')
+    else:
+        stream = sys.stdin.buffer
+
+    try:
+        decoded, skipped = decode(stream, formats, sys.stdout, follow=bool(args.port))
+    except KeyboardInterrupt:
+        return
+    print(f'✓ {decoded} records decoded, {skipped} bytes skipped ({len(formats)} formats known)', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+"""
+On-Device Model Exporter
+========================
+Fits the small PV and consumption model the ESP32 falls back on when the
+server's predictions go stale, and writes it as constexpr tables
+(tiny_model.h).
+
+The model only uses what the ESP32 knows without the server: the clock
+(hour, day of year, weekend) and the last PV and load it saw.
+
+    PV   = w_sun * sun + w_clear * sun * clearness + bias
+    load = w_profile * profile[hour] + w_recent * recent_load + weekend + bias
+
+sun is the sine of the sun's elevation times TINY_PV_NORM (W), clearness
+is the last seen PV divided by that clear-sky value, and profile is the
+mean load per hour. Hours are the server's local time, which the ESP32's
+TIME_ZONE must match. By default it is trained on what the devices
+reported (energy_data); --table predictions trains on the server models'
+output instead, so the ESP32 imitates them.
+
+The last --holdout-days are kept out of the fit and the error reported is
+measured on them. At least MIN_TRAIN_DAYS of training data are required.
+
+Run after collecting more data or retraining the server models:
+    python export_tiny_model.py [--table energy_data] [--latitude 35.0]
+
+--prior writes the untrained model the repository ships (clear sky at
+half clearness, load held at the last reading), without a database.
+"""
+
+import argparse
+import math
+import sqlite3
+import time
+from datetime import datetime, timedelta
+
+DATABASE_PATH = 'smart_house.db'
+HEADER_PATH = 'tiny_model.h'
+
+WEIGHT_SHIFT = 10           # Weights are Q10 fixed point
+RIDGE = 0.05                # Pull towards the prior, relative to each feature's scale
+MAX_GAP_HOURS = 2           # Consecutive rows further apart are not paired
+MIN_SUN = 0.1               # Below this the clearness is not observable
+NORM_SUN = 0.3              # Clear-sky scale only from samples with the sun this high
+NORM_PERCENTILE = 0.9
+# Weights the fit starts from: PV is clear sky times clearness, load the profile
+PV_PRIOR = [0.0, 1.0, 0.0]
+LOAD_PRIOR = [1.0, 0.0, 0.0, 0.0]
+HOLDOUT_DAYS = 2            # Newest days, scored but not fitted
+MIN_TRAIN_DAYS = 7          # A week, so every weekday and hour is seen
+MIN_SAMPLES = 7 * 24        # Consecutive pairs in the training rows, hourly for a week
+MIN_HOLDOUT_SAMPLES = 24
+# --prior: what the ESP32 assumes without a fitted model (STALE_PV_DERATE)
+PRIOR_PV_NORM = 4000.0
+PRIOR_CLEARNESS = 0.5
+PRIOR_LOAD = 500.0
+PRIOR_LOAD_WEIGHTS = [0.0, 1.0, 0.0, 0.0]   # Hold the last load, fade to PRIOR_LOAD
+
+
+def sun_factor(hour, day_of_year, latitude, solar_noon):
+    """Sine of the sun's elevation, 0 at night (same formula as the ESP32)"""
+    declination = math.radians(23.44) * math.sin(2 * math.pi * (284 + day_of_year) / 365)
+    hour_angle = math.radians(15 * (hour - solar_noon))
+    lat = math.radians(latitude)
+    value = (math.sin(lat) * math.sin(declination)
+             + math.cos(lat) * math.cos(declination) * math.cos(hour_angle))
+    return max(value, 0.0)
+
+
+def load_rows(db_path, table):
+    """(time, PV W, load W) ordered by time"""
+    conn = sqlite3.connect(db_path)
+    rows = conn.execute(f'SELECT timestamp, pv_power, consumption FROM {table} ORDER BY timestamp').fetchall()
+    conn.close()
+
+    parsed = []
+    for timestamp, pv_power, consumption in rows:
+        try:
+            when = datetime.strptime(timestamp[:19], '%Y-%m-%d %H:%M:%S')
+        except (TypeError, ValueError):
+            continue
+        parsed.append((when, float(pv_power or 0), float(consumption or 0)))
+    return parsed
+
+
+def solve(features, targets, prior):
+    """
+    Ridge least squares towards `prior` through the normal equations, no numpy
+    
+    A day of rows often leaves features collinear (a flat load, a clear
+    sky); the penalty then keeps the prior instead of trading huge weights.
+    """
+    n = len(features[0])
+    a = [[0.0] * n for _ in range(n)]
+    b = [0.0] * n
+    for x, y in zip(features, targets):
+        for i in range(n):
+            b[i] += x[i] * y
+            for j in range(n):
+                a[i][j] += x[i] * x[j]
+    for i in range(n):
+        penalty = RIDGE * max(a[i][i], 1.0)   # Unused features (no weekend rows) stay at the prior
+        a[i][i] += penalty
+        b[i] += penalty * prior[i]
+
+    # Gaussian elimination with partial pivoting
+    for col in range(n):
+        pivot = max(range(col, n), key=lambda r: abs(a[r][col]))
+        a[col], a[pivot] = a[pivot], a[col]
+        b[col], b[pivot] = b[pivot], b[col]
+        for row in range(col + 1, n):
+            f = a[row][col] / a[col][col]
+            for k in range(col, n):
+                a[row][k] -= f * a[col][k]
+            b[row] -= f * b[col]
+    w = [0.0] * n
+    for row in reversed(range(n)):
+        w[row] = (b[row] - sum(a[row][k] * w[k] for k in range(row + 1, n))) / a[row][row]
+    return w
+
+
+def fixed(value):
+    """Q10 as int16"""
+    return max(-32768, min(32767, round(value * (1 << WEIGHT_SHIFT))))
+
+
+def watts(value):
+    return max(-32768, min(32767, round(value)))
+
+
+def sun_at(when, latitude, solar_noon):
+    """
+    Sun factor at a server-local timestamp
+    
+    solar_noon is in local standard time, so daylight saving is taken
+    out of the hour, as the ESP32 does with its TIME_ZONE.
+    """
+    dst = time.localtime(time.mktime(when.timetuple())).tm_isdst > 0
+    hour = when.hour + when.minute / 60 - (1 if dst else 0)
+    return sun_factor(hour, when.timetuple().tm_yday, latitude, solar_noon)
+
+
+def pairs(rows, model, latitude, solar_noon):
+    """Features from each row and the one before it: (PV x, PV y, load x, load y)"""
+    pv_norm = model['pv_norm']
+    pv_x, pv_y, load_x, load_y = [], [], [], []
+    for (before, pv_before, load_before), (when, pv, load) in zip(rows, rows[1:]):
+        if (when - before).total_seconds() > MAX_GAP_HOURS * 3600:
+            continue
+        sun_before = sun_at(before, latitude, solar_noon)
+        clearness = (min(pv_before / (sun_before * pv_norm), 1.5) if sun_before >= MIN_SUN
+                     else model['clearness'])
+        sun = sun_at(when, latitude, solar_noon) * pv_norm
+        pv_x.append([sun, sun * clearness, 1.0])
+        pv_y.append(pv)
+        weekend = 1.0 if when.weekday() >= 5 else 0.0
+        load_x.append([model['profile'][when.hour], load_before, weekend, 1.0])
+        load_y.append(load)
+    return pv_x, pv_y, load_x, load_y
+
+
+def mean_errors(model, pv_x, pv_y, load_x, load_y):
+    """Mean absolute PV and load error in W"""
+    pv_mae = sum(abs(max(sum(w * x for w, x in zip(model['pv'], xs)), 0) - y)
+                 for xs, y in zip(pv_x, pv_y)) / len(pv_y)
+    load_mae = sum(abs(sum(w * x for w, x in zip(model['load'], xs)) - y)
+                   for xs, y in zip(load_x, load_y)) / len(load_y)
+    return pv_mae, load_mae
+
+
+def split_holdout(rows, days):
+    """Training rows and the newest `days` of rows"""
+    if not rows:
+        raise SystemExit('✗ No rows')
+    cutoff = rows[-1][0] - timedelta(days=days)
+    train = [row for row in rows if row[0] <= cutoff]
+    test = [row for row in rows if row[0] > cutoff]
+    return train, test
+
+
+def fit(rows, latitude, solar_noon):
+    # Clear-sky scale: the sunny end of the samples defines full clearness
+    ratios = sorted(pv / sun_at(when, latitude, solar_noon) for when, pv, _ in rows
+                    if sun_at(when, latitude, solar_noon) >= NORM_SUN)
+    pv_norm = ratios[int(NORM_PERCENTILE * (len(ratios) - 1))] if ratios else 0.0
+    if pv_norm <= 0:
+        pv_norm = 1000.0
+    clear_samples = [min(pv / (sun_at(when, latitude, solar_noon) * pv_norm), 1.5)
+                     for when, pv, _ in rows if sun_at(when, latitude, solar_noon) >= MIN_SUN]
+    mean_clearness = sum(clear_samples) / len(clear_samples) if clear_samples else 0.5
+
+    by_hour = [[] for _ in range(24)]
+    for when, _, load in rows:
+        by_hour[when.hour].append(load)
+    mean_load = sum(load for _, _, load in rows) / len(rows)
+    profile = [sum(v) / len(v) if v else mean_load for v in by_hour]
+
+    model = {'pv_norm': pv_norm, 'clearness': mean_clearness, 'profile': profile}
+    pv_x, pv_y, load_x, load_y = pairs(rows, model, latitude, solar_noon)
+    if len(pv_y) < MIN_SAMPLES:
+        raise SystemExit(f'✗ Only {len(pv_y)} consecutive training samples, need {MIN_SAMPLES}')
+
+    model['pv'] = solve(pv_x, pv_y, PV_PRIOR)
+    model['load'] = solve(load_x, load_y, LOAD_PRIOR)
+    model['samples'] = len(pv_y)
+    return model
+
+
+def fit_and_score(rows, latitude, solar_noon, holdout_days):
+    """Fit on all but the newest days and measure the error on those"""
+    train, test = split_holdout(rows, holdout_days)
+    days = (train[-1][0] - train[0][0]).total_seconds() / 86400 if train else 0
+    if days < MIN_TRAIN_DAYS:
+        raise SystemExit(f'✗ Training rows span {days:.1f} days, need {MIN_TRAIN_DAYS} '
+                         f'plus {holdout_days} held out')
+
+    model = fit(train, latitude, solar_noon)
+    scored = pairs(test, model, latitude, solar_noon)
+    if len(scored[1]) < MIN_HOLDOUT_SAMPLES:
+        raise SystemExit(f'✗ Only {len(scored[1])} held-out samples, need {MIN_HOLDOUT_SAMPLES}')
+    model['pv_mae'], model['load_mae'] = mean_errors(model, *scored)
+    model['holdout'] = len(scored[1])
+    return model
+
+
+def prior_model():
+    """The model without training data"""
+    return {
+        'pv_norm': PRIOR_PV_NORM, 'clearness': PRIOR_CLEARNESS, 'profile': [PRIOR_LOAD] * 24,
+        'pv': PV_PRIOR, 'load': PRIOR_LOAD_WEIGHTS
+    }
+
+
+def build_header(model, source, latitude, solar_noon):
+    """Return the C header text for the fitted model"""
+    pv_w = model['pv']
+    load_w = model['load']
+    profile = ', '.join(str(max(0, min(65535, round(v)))) for v in model['profile'])
+    def entry(declaration, comment=''):
+        return f'{declaration:<64}// {comment}' if comment else declaration
+
+    if 'samples' in model:
+        summary = (f'// {model["samples"]} samples, held-out ({model["holdout"]}) mean abs error: '
+                   f'PV {model["pv_mae"]:.0f} W, load {model["load_mae"]:.0f} W')
+    else:
+        summary = '// Untrained: clear sky at half clearness, load held at the last reading'
+    lines = [
+        f'// Generated by export_tiny_model.py from {source} - do not edit.',
+        summary,
+        '#pragma once',
+        '',
+        '#include <stdint.h>',
+        '',
+        entry(f'constexpr float TINY_LATITUDE = {latitude:.2f}f;'),
+        entry(f'constexpr float TINY_SOLAR_NOON = {solar_noon:.2f}f;', 'Local standard time hour'),
+        entry(f'constexpr int TINY_WEIGHT_SHIFT = {WEIGHT_SHIFT};', f'Weights are Q{WEIGHT_SHIFT}'),
+        entry(f'constexpr uint16_t TINY_PV_NORM = {round(model["pv_norm"])};', 'W with the sun overhead, clear sky'),
+        entry(f'constexpr int16_t TINY_PV_CLEARNESS = {fixed(model["clearness"])};', 'Used without a recent reading'),
+        entry(f'constexpr int16_t TINY_PV_WEIGHTS[2] = {{{fixed(pv_w[0])}, {fixed(pv_w[1])}}};', 'sun, sun * clearness'),
+        entry(f'constexpr int16_t TINY_PV_BIAS = {watts(pv_w[2])};', 'W'),
+        entry(f'constexpr uint16_t TINY_LOAD_PROFILE[24] = {{{profile}}};'),
+        entry(f'constexpr int16_t TINY_LOAD_WEIGHTS[2] = {{{fixed(load_w[0])}, {fixed(load_w[1])}}};', 'profile, recent load'),
+        entry(f'constexpr int16_t TINY_LOAD_WEEKEND = {watts(load_w[2])};', 'W'),
+        entry(f'constexpr int16_t TINY_LOAD_BIAS = {watts(load_w[3])};', 'W'),
+        '',
+    ]
+    return '\n'.join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Export the ESP32 fallback model')
+    parser.add_argument('--db', default=DATABASE_PATH)
+    parser.add_argument('--table', default='energy_data', choices=['energy_data', 'predictions'])
+    parser.add_argument('--latitude', type=float, default=35.0)
+    parser.add_argument('--solar-noon', type=float, default=12.0)
+    parser.add_argument('--holdout-days', type=float, default=HOLDOUT_DAYS)
+    parser.add_argument('--prior', action='store_true', help='Write the untrained model')
+    parser.add_argument('--output', default=HEADER_PATH)
+    args = parser.parse_args()
+
+    if args.prior:
+        header = build_header(prior_model(), '--prior', args.latitude, args.solar_noon)
+    else:
+        rows = load_rows(args.db, args.table)
+        model = fit_and_score(rows, args.latitude, args.solar_noon, args.holdout_days)
+        header = build_header(model, f'{args.db} ({args.table})', args.latitude, args.solar_noon)
+        print(f"✓ {args.table}: {model['samples']} training samples, {model['holdout']} held out")
+        print(f"✓ Held-out mean abs error: PV {model['pv_mae']:.0f} W, load {model['load_mae']:.0f} W")
+
+    with open(args.output, 'w') as f:
+        f.write(header)
+    print(f"✓ Wrote {args.output}")
+
+
+if __name__ == '__main__':
+    main()
@@ -61,6 +61,40 @@ def check_dependencies():
     return True
 
 
+def migrate_status_tables(cursor):
+    """Add device ids to status tables from before they existed (same as the API server)"""
+    columns = {row[1] for row in cursor.execute('PRAGMA table_info(energy_data)')}
+    if columns and 'device_id' not in columns:
+        # UNIQUE(timestamp) cannot be altered; rebuild keyed on (device_id, timestamp)
+        copied = ('timestamp, pv_power, consumption, battery_soc, grid_power, '
+                  'surplus, deficit, system_efficiency, created_at')
+        cursor.executescript(f'''
+            CREATE TABLE energy_data_new (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                device_id TEXT NOT NULL DEFAULT '',
+                timestamp TEXT NOT NULL,
+                pv_power REAL,
+                consumption REAL,
+                battery_soc REAL,
+                grid_power INTEGER,
+                surplus REAL,
+                deficit REAL,
+                system_efficiency REAL,
+                created_at TEXT DEFAULT CURRENT_TIMESTAMP,
+                UNIQUE(device_id, timestamp)
+            );
+            INSERT INTO energy_data_new ({copied}) SELECT {copied} FROM energy_data;
+            DROP TABLE energy_data;
+            ALTER TABLE energy_data_new RENAME TO energy_data;
+        ''')
+        print("  ✓ energy_data migrated to per-device rows")
+    
+    columns = {row[1] for row in cursor.execute('PRAGMA table_info(device_status)')}
+    if columns and 'node_id' not in columns:
+        cursor.execute("ALTER TABLE device_status ADD COLUMN node_id TEXT NOT NULL DEFAULT ''")
+        print("  ✓ device_status gained node_id")
+
+
 def initialize_database():
     """Initialize SQLite database"""
     print_step(2, "Initializing Database")
@@ -105,9 +139,12 @@ def initialize_database():
         ''')
         print("  ✓ consumption_predictions table created")
         
+        migrate_status_tables(cursor)
+        
         cursor.execute('''
             CREATE TABLE IF NOT EXISTS energy_data (
                 id INTEGER PRIMARY KEY AUTOINCREMENT,
+                device_id TEXT NOT NULL DEFAULT '',
                 timestamp TEXT NOT NULL,
                 pv_power REAL,
                 consumption REAL,
@@ -117,7 +154,7 @@ def initialize_database():
                 deficit REAL,
                 system_efficiency REAL,
                 created_at TEXT DEFAULT CURRENT_TIMESTAMP,
-                UNIQUE(timestamp)
+                UNIQUE(device_id, timestamp)
             )
         ''')
         print("  ✓ energy_data table created")
@@ -130,7 +167,8 @@ def initialize_database():
                 status INTEGER,
                 power_consumption REAL,
                 timestamp TEXT NOT NULL,
-                created_at TEXT DEFAULT CURRENT_TIMESTAMP
+                created_at TEXT DEFAULT CURRENT_TIMESTAMP,
+                node_id TEXT NOT NULL DEFAULT ''
             )
         ''')
         print("  ✓ device_status table created")
@@ -138,6 +176,7 @@ def initialize_database():
         # Create indexes for performance
         cursor.execute('CREATE INDEX IF NOT EXISTS idx_energy_timestamp ON energy_data(timestamp)')
         cursor.execute('CREATE INDEX IF NOT EXISTS idx_device_time ON device_status(device_name, timestamp)')
+        cursor.execute('CREATE INDEX IF NOT EXISTS idx_device_status_node ON device_status(node_id, timestamp)')
         print("  ✓ Indexes created")
         
         conn.commit()
@@ -0,0 +1,47 @@
+// ===== Host Benchmarks =====
+// Runs the EMS_BENCH probes in the host build and prints the same JSON
+// report the device serves at /api/bench:
+//
+//   ems_bench [--iterations N] > bench.json
+//
+// HTTP calls get a canned 200 response, so they measure request setup,
+// serialization and parsing but no network time.
+#include "../Ems_integrated.cpp"
+
+const char* const BENCH_PREDICTION = "{\"timestamp\":\"2026-02-16 12:00:00\",\"pv_power\":2850.5,"
+                                     "\"consumption\":1420.25,\"battery_soc\":72.5,\"confidence\":0.91}";
+
+int main(int argc, char** argv) {
+  int iterations = 2000;
+  if (argc == 3 && strcmp(argv[1], "--iterations") == 0) {
+    iterations = atoi(argv[2]);
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [--iterations N]\n", argv[0]);
+    return 2;
+  }
+
+  simEpoch = 1771243200;            // 2026-02-16 12:00 UTC: daylight, surplus
+  simAdvance(1000000);
+  simWallClock = true;
+  initBench();
+  initApiClient();
+  publishControlState();
+
+  simHttpResponse.code = 200;
+  simHttpResponse.body = BENCH_PREDICTION;
+
+  for (int i = 0; i < iterations; i++) {
+    controlTick();
+    handleRoot();
+    handleApiData();
+    fetchPredictions();
+    sendStatusToDatabase();
+    syncWithServer();
+    consoleDrain();
+    simAdvance((uint64_t)CONTROL_INTERVAL * 1000);
+  }
+
+  handleBench();
+  fwrite(server.lastBody.data(), 1, server.lastBody.size(), stdout);
+  return 0;
+}
@@ -0,0 +1,317 @@
+// ===== Host Simulation =====
+// Builds the firmware against the shims in sim/shims and replays a recorded
+// PV/consumption trace (esp32_data.csv format) on a virtual clock. Each
+// control tick runs the real controlTick(); no time is spent waiting, so a
+// year of decisions takes seconds.
+//
+//   ems_sim [--trace FILE] [--days N] [--step S] [--every S] [--soc P] [--verbose]
+//
+// The trace is fed in the way the server would feed it: PV and consumption
+// arrive as a prediction every API_INTERVAL, and with EMS_LOOKAHEAD (or
+// EMS_PREDICTION_CACHE) the next 24 h of the trace are the forecast. Load comes from
+// the device table and relay decisions. A trace shorter than the run repeats.
+//
+// stdout gets one CSV row per --every seconds, stderr a summary.
+#include "../Ems_integrated.cpp"
+
+#include <vector>
+#include <chrono>
+
+struct TracePoint {
+  int64_t offset;                   // Seconds from the first sample
+  float pvPower;
+  float consumption;
+};
+
+struct Trace {
+  std::vector<TracePoint> points;
+  time_t start = 0;
+  int64_t period = 0;               // Length before it repeats
+};
+
+struct SimOptions {
+  const char* tracePath = "../esp32_data.csv";
+  float days = 1;
+  unsigned long stepMs = CONTROL_INTERVAL;
+  unsigned long reportSeconds = 900;
+  float initialSoc = 70;
+};
+
+// ===== Trace =====
+int findColumn(char* header, const char* name) {
+  int column = 0;
+  for (char* field = strtok(header, ",\r\n"); field; field = strtok(NULL, ",\r\n"), column++) {
+    if (strcmp(field, name) == 0) return column;
+  }
+  return -1;
+}
+
+time_t parseTimestamp(const char* text) {
+  struct tm t = {};
+  if (sscanf(text, "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+             &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) return -1;
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+  return timegm(&t);
+}
+
+bool loadTrace(const char* path, Trace& trace) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "Cannot open trace %s\n", path);
+    return false;
+  }
+
+  char line[256];
+  char header[256];
+  if (!fgets(line, sizeof(line), file)) {
+    fclose(file);
+    return false;
+  }
+  strcpy(header, line);
+  int timeColumn = findColumn(header, "timestamp");
+  strcpy(header, line);
+  int pvColumn = findColumn(header, "pv_power");
+  strcpy(header, line);
+  int loadColumn = findColumn(header, "consumption");
+  if (timeColumn < 0 || pvColumn < 0 || loadColumn < 0) {
+    fprintf(stderr, "Trace needs timestamp, pv_power and consumption columns\n");
+    fclose(file);
+    return false;
+  }
+
+  std::vector<std::pair<time_t, TracePoint>> rows;
+  while (fgets(line, sizeof(line), file)) {
+    TracePoint point = {};
+    time_t at = -1;
+    int column = 0;
+    for (char* field = strtok(line, ",\r\n"); field; field = strtok(NULL, ",\r\n"), column++) {
+      if (column == timeColumn) at = parseTimestamp(field);
+      if (column == pvColumn) point.pvPower = atof(field);
+      if (column == loadColumn) point.consumption = atof(field);
+    }
+    if (at >= 0) rows.push_back({at, point});
+  }
+  fclose(file);
+  if (rows.size() < 2) {
+    fprintf(stderr, "Trace %s has fewer than two samples\n", path);
+    return false;
+  }
+
+  // Recordings are not always in order (esp32_data.csv is newest first)
+  std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+  trace.start = rows.front().first;
+  for (auto& row : rows) {
+    row.second.offset = row.first - trace.start;
+    trace.points.push_back(row.second);
+  }
+
+  // One more sample interval so the last point blends back into the first
+  int64_t lastGap = trace.points.back().offset - trace.points[trace.points.size() - 2].offset;
+  trace.period = trace.points.back().offset + lastGap;
+  return true;
+}
+
+// Linear interpolation, wrapping at the end of the trace
+TracePoint sampleTrace(const Trace& trace, int64_t seconds) {
+  int64_t at = seconds % trace.period;
+  auto next = std::upper_bound(trace.points.begin(), trace.points.end(), at,
+                               [](int64_t t, const TracePoint& p) { return t < p.offset; });
+  const TracePoint& b = (next == trace.points.end()) ? trace.points.front() : *next;
+  const TracePoint& a = *(next - 1);
+  int64_t span = (next == trace.points.end()) ? trace.period - a.offset : b.offset - a.offset;
+  float f = span > 0 ? (float)(at - a.offset) / span : 0;
+
+  TracePoint point;
+  point.offset = at;
+  point.pvPower = a.pvPower + (b.pvPower - a.pvPower) * f;
+  point.consumption = a.consumption + (b.consumption - a.consumption) * f;
+  return point;
+}
+
+// ===== Inputs =====
+int64_t simSeconds() {
+  return (int64_t)(simMicros / 1000000);
+}
+
+void deliverPrediction(const Trace& trace) {
+  TracePoint point = sampleTrace(trace, simSeconds());
+  PredictionInput input;
+  input.pvPower = point.pvPower;
+  input.consumption = point.consumption;
+  input.receivedAt = millis();
+  predictionState.publish(input);
+}
+
+#if EMS_LOOKAHEAD || EMS_PREDICTION_CACHE
+// Hour-of-day slots, like /api/forecast; runs the planner in line
+#if EMS_LOOKAHEAD
+const unsigned long FORECAST_REPLAY_INTERVAL = PLAN_INTERVAL;
+#else
+const unsigned long FORECAST_REPLAY_INTERVAL = FORECAST_INTERVAL;
+#endif
+
+void deliverForecast(const Trace& trace) {
+  ForecastProfile forecast = {};
+  for (int h = 0; h < FORECAST_HOURS; h++) {
+    int64_t at = simSeconds() + h * 3600;
+    time_t wall = simEpoch + at;
+    struct tm t;
+    localtime_r(&wall, &t);     // Slots by local hour, like parseForecast()
+    TracePoint point = sampleTrace(trace, at + 1800);   // Mid-hour mean
+    forecast.pvPower[t.tm_hour] = (uint16_t)max(point.pvPower, 0.0f);
+    forecast.consumption[t.tm_hour] = (uint16_t)max(point.consumption, 0.0f);
+    forecast.hoursPresent |= 1UL << t.tm_hour;
+  }
+  forecast.receivedAt = millis();
+  forecastState.publish(forecast);
+#if EMS_LOOKAHEAD
+  solveDispatchPlan();
+#endif
+}
+#endif
+
+// ===== Results =====
+// The firmware's counters restart at midnight; these only grow
+struct SimTotals {
+  EnergyTotals energy = {};
+  uint32_t switches = 0;
+  uint32_t channelSwitches[RELAY_CHANNELS] = {};
+  float socMin = 100;
+  float socMax = 0;
+  double socSum = 0;
+  uint64_t ticks = 0;
+};
+
+float grow(float now, float before) {
+  return now >= before ? now - before : now;
+}
+
+void accumulate(SimTotals& totals, const EnergyTotals& before, const uint16_t* switchesBefore) {
+  totals.energy.pvGeneration += grow(dailyEnergy.pvGeneration, before.pvGeneration);
+  totals.energy.consumption += grow(dailyEnergy.consumption, before.consumption);
+  totals.energy.batteryCharge += grow(dailyEnergy.batteryCharge, before.batteryCharge);
+  totals.energy.batteryDischarge += grow(dailyEnergy.batteryDischarge, before.batteryDischarge);
+  totals.energy.gridImport += grow(dailyEnergy.gridImport, before.gridImport);
+  for (int i = 0; i < RELAY_CHANNELS; i++) {
+    uint32_t switches = switchesToday[i] >= switchesBefore[i] ? switchesToday[i] - switchesBefore[i] : switchesToday[i];
+    totals.channelSwitches[i] += switches;
+    totals.switches += switches;
+  }
+
+  totals.socMin = min(totals.socMin, batterySOC);
+  totals.socMax = max(totals.socMax, batterySOC);
+  totals.socSum += batterySOC;
+  totals.ticks++;
+}
+
+void printRow(const SimTotals& totals) {
+  time_t wall = simEpoch + simSeconds();
+  struct tm t;
+  localtime_r(&wall, &t);
+  printf("%04d-%02d-%02d %02d:%02d:%02d,%.1f,%.1f,%.2f,%d,%d,0x%02x,%.1f\n",
+         t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+         currentPvPower, totalLoad, batterySOC, gridPower, waterHeater,
+         (unsigned)deviceState, totals.energy.gridImport);
+}
+
+void printSummary(const SimTotals& totals, double days, double wallSeconds) {
+  fprintf(stderr, "Simulated %.1f days in %.2f s (%.0fx real time, %llu ticks)\n",
+          days, wallSeconds, days * 86400 / max(wallSeconds, 1e-6), (unsigned long long)totals.ticks);
+  fprintf(stderr, "PV: %.2f kWh, load: %.2f kWh, grid import: %.2f kWh\n",
+          totals.energy.pvGeneration / 1000, totals.energy.consumption / 1000, totals.energy.gridImport / 1000);
+  fprintf(stderr, "Battery in: %.2f kWh, out: %.2f kWh\n",
+          totals.energy.batteryCharge / 1000, totals.energy.batteryDischarge / 1000);
+  fprintf(stderr, "SOC min/mean/max: %.1f / %.1f / %.1f %%\n",
+          totals.socMin, totals.socSum / max(totals.ticks, (uint64_t)1), totals.socMax);
+  fprintf(stderr, "Relay switches: %u (", totals.switches);
+  for (int i = 0; i < RELAY_CHANNELS; i++) {
+    fprintf(stderr, "%s%s %u", i ? ", " : "", relayDescriptor(i).name, totals.channelSwitches[i]);
+  }
+  fprintf(stderr, ")\n");
+}
+
+// ===== Main =====
+bool parseOptions(int argc, char** argv, SimOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (strcmp(arg, "--verbose") == 0) {
+      Serial.echo = true;
+      continue;
+    }
+    if (!value) return false;
+    if (strcmp(arg, "--trace") == 0) options.tracePath = value;
+    else if (strcmp(arg, "--days") == 0) options.days = atof(value);
+    else if (strcmp(arg, "--step") == 0) options.stepMs = (unsigned long)(atof(value) * 1000);
+    else if (strcmp(arg, "--every") == 0) options.reportSeconds = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--soc") == 0) options.initialSoc = atof(value);
+    else return false;
+    i++;
+  }
+  return options.days > 0 && options.stepMs > 0 && options.reportSeconds > 0;
+}
+
+int main(int argc, char** argv) {
+  SimOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    fprintf(stderr, "usage: %s [--trace FILE] [--days N] [--step S] [--every S] [--soc P] [--verbose]\n", argv[0]);
+    return 2;
+  }
+
+  Trace trace;
+  if (!loadTrace(options.tracePath, trace)) return 1;
+  simEpoch = trace.start;
+  simAdvance(1000000);              // millis() == 0 means "never" in places
+
+  // The control half of setup(): no WiFi, server or tasks
+  initTime();
+  batterySOC = options.initialSoc;
+#if EMS_FAST_PATH
+  simPinLevel[GRID_SENSE_PIN] = HIGH;
+  simPinLevel[OVERCURRENT_PIN] = HIGH;
+#endif
+#if EMS_FIXED_POINT
+  fxSetBatterySOC(batterySOC);
+#endif
+  publishControlState();
+
+  uint64_t endUs = simMicros + (uint64_t)(options.days * 86400e6);
+  unsigned long nextPredictionAt = 0;
+  unsigned long nextPlanAt = 0;
+  unsigned long nextReportAt = 0;
+  SimTotals totals;
+
+  printf("time,pv_w,load_w,soc,grid,water_heater,devices,grid_import_wh\n");
+  auto started = std::chrono::steady_clock::now();
+
+  while (simMicros < endUs) {
+    if ((long)(millis() - nextPredictionAt) >= 0) {
+      deliverPrediction(trace);
+      nextPredictionAt = millis() + API_INTERVAL;
+    }
+#if EMS_LOOKAHEAD || EMS_PREDICTION_CACHE
+    if ((long)(millis() - nextPlanAt) >= 0) {
+      deliverForecast(trace);
+      nextPlanAt = millis() + FORECAST_REPLAY_INTERVAL;
+    }
+#endif
+
+    EnergyTotals before = dailyEnergy;
+    uint16_t switchesBefore[RELAY_CHANNELS];
+    memcpy(switchesBefore, switchesToday, sizeof(switchesBefore));
+    controlTick();
+    consoleDrain();                 // The console task never runs here
+    accumulate(totals, before, switchesBefore);
+
+    if ((long)(millis() - nextReportAt) >= 0) {
+      printRow(totals);
+      nextReportAt = millis() + options.reportSeconds * 1000;
+    }
+    simAdvance((uint64_t)options.stepMs * 1000);
+  }
+
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  printSummary(totals, options.days, wallSeconds);
+  return 0;
+}
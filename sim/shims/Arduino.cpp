@@ -0,0 +1,82 @@
+// Host implementations behind the shims in this directory
+#include "Arduino.h"
+#include "WiFi.h"
+#include "HTTPClient.h"
+#include "LittleFS.h"
+#include "esp_timer.h"
+#include "soc/gpio_reg.h"
+
+#include <chrono>
+
+uint64_t simMicros = 0;
+time_t simEpoch = 0;
+bool simWallClock = false;
+uint8_t simPinLevel[40];
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+LittleFSFS LittleFS;
+SimHttpResponse simHttpResponse;
+
+// ===== Clock =====
+unsigned long millis() { return (unsigned long)(simMicros / 1000); }
+unsigned long micros() { return (unsigned long)simMicros; }
+void delay(unsigned long ms) { simAdvance((uint64_t)ms * 1000); }
+void yield() {}
+
+// Benchmarks time code with esp_timer_get_time(), so they need real time on top
+int64_t esp_timer_get_time() {
+  if (!simWallClock) return (int64_t)simMicros;
+  static auto start = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return (int64_t)simMicros + std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+void configTime(long gmtOffset, int daylightOffset, const char* server1,
+                const char* server2, const char* server3) {}
+
+// Sets the host's zone, so local time in the simulation follows TIME_ZONE
+void configTzTime(const char* tz, const char* server1, const char* server2, const char* server3) {
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+bool getLocalTime(struct tm* info, uint32_t ms) {
+  time_t now = simEpoch + (time_t)(simMicros / 1000000);
+  localtime_r(&now, info);
+  return true;
+}
+
+// ===== GPIO =====
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  if (pin < sizeof(simPinLevel)) simPinLevel[pin] = level;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < sizeof(simPinLevel) ? simPinLevel[pin] : LOW;
+}
+
+void simGpioWrite(int reg, uint32_t bits) {
+  for (uint8_t pin = 0; pin < 32; pin++) {
+    if (bits & (1UL << pin)) simPinLevel[pin] = (reg == GPIO_OUT_W1TS_REG) ? HIGH : LOW;
+  }
+}
+
+// ===== FreeRTOS =====
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+void vTaskDelay(TickType_t ticks) { delay(ticks); }
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t period) {}
+TickType_t xTaskGetTickCount() { return (TickType_t)millis(); }
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) { return 0; }
+void xTaskNotifyGive(TaskHandle_t task) {}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) { return (QueueHandle_t)1; }
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) { return pdFALSE; }
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) { return pdFALSE; }
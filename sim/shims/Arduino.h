@@ -0,0 +1,218 @@
+// Host shim for the parts of the Arduino-ESP32 core the firmware uses.
+// Time is virtual: millis(), micros(), esp_timer_get_time() and
+// getLocalTime() all read the simulation clock, which only moves when the
+// driver (or delay()) advances it.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+#define OUTPUT 1
+#define FALLING 2
+#define PROGMEM
+#define IRAM_ATTR
+#define F(text) (text)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define PI 3.1415926535897932384626433832795
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+
+typedef uint8_t byte;
+
+// ===== Simulation Clock =====
+extern uint64_t simMicros;          // Since boot
+extern time_t simEpoch;             // Wall-clock time at boot (UTC)
+extern bool simWallClock;           // esp_timer_get_time() also counts real time
+
+inline void simAdvance(uint64_t us) { simMicros += us; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// ===== GPIO =====
+// Pin levels are kept so a driver can check relay outputs
+extern uint8_t simPinLevel[40];
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void attachInterrupt(int interrupt, void (*isr)(), int mode) {}   // The driver calls ISRs itself
+
+inline void esp_restart() { exit(3); }
+#define RTC_NOINIT_ATTR
+enum esp_reset_reason_t { ESP_RST_POWERON = 1, ESP_RST_SW = 3 };
+inline esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
+
+// ===== Strings and Streams =====
+class String {
+ public:
+  String() {}
+  String(const char* text) : value(text ? text : "") {}
+  String(const std::string& text) : value(text) {}
+
+  const char* c_str() const { return value.c_str(); }
+  size_t length() const { return value.size(); }
+  bool operator==(const char* other) const { return value == other; }
+  int toInt() const { return atoi(value.c_str()); }
+  float toFloat() const { return atof(value.c_str()); }
+
+  friend String operator+(const char* a, const String& b) { return String(a + b.value); }
+  friend String operator+(const String& a, const char* b) { return String(a.value + b); }
+
+ private:
+  std::string value;
+};
+
+class IPAddress {
+ public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} {}
+  explicit IPAddress(uint32_t address) { memcpy(octets, &address, 4); }
+
+  operator uint32_t() const {
+    uint32_t address;
+    memcpy(&address, octets, 4);
+    return address;
+  }
+
+  String toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+    return String(text);
+  }
+
+ private:
+  uint8_t octets[4] = {0, 0, 0, 0};
+};
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+
+  size_t print(const char* text) { return write(text); }
+  size_t print(const String& text) { return write(text.c_str()); }
+  size_t print(const IPAddress& ip) { return write(ip.toString().c_str()); }
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& value) { return print(value) + println(); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0) return 0;
+    return write((const uint8_t*)buffer, min((size_t)len, sizeof(buffer) - 1));
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual size_t readBytes(char* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length) {
+      int c = read();
+      if (c < 0) break;
+      buffer[n++] = (char)c;
+    }
+    return n;
+  }
+};
+
+// Output goes to stderr only while echo is set, so a fast-forward run is
+// not limited by terminal speed
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long baud) {}
+  size_t write(uint8_t c) override {
+    if (echo) fputc(c, stderr);
+    return 1;
+  }
+  using Print::write;
+  int availableForWrite() { return 128; }
+  void flush() {}
+
+  // Skips the formatting as well while output is off
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    if (!echo) return 0;
+    va_list args;
+    va_start(args, format);
+    int len = vfprintf(stderr, format, args);
+    va_end(args);
+    return len < 0 ? 0 : len;
+  }
+
+  bool echo = false;
+};
+
+extern HardwareSerial Serial;
+
+// ===== Time =====
+void configTime(long gmtOffset, int daylightOffset, const char* server1,
+                const char* server2 = nullptr, const char* server3 = nullptr);
+void configTzTime(const char* tz, const char* server1, const char* server2 = nullptr,
+                  const char* server3 = nullptr);
+bool getLocalTime(struct tm* info, uint32_t ms = 5000);
+
+// ===== FreeRTOS =====
+// The simulation is single-threaded: tasks are never started and the driver
+// calls the control entry points itself. Queues accept nothing, so work
+// handed to the HTTP worker is dropped.
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// One thread, so critical sections have nothing to exclude
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t period);
+TickType_t xTaskGetTickCount();
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+void xTaskNotifyGive(TaskHandle_t task);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
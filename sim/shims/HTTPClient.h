@@ -0,0 +1,50 @@
+// Host shim: requests get simHttpResponse, which by default is a refused
+// connection. A driver can set a status code and body to serve instead.
+#pragma once
+
+#include "WiFi.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+struct SimHttpResponse {
+  int code = HTTPC_ERROR_CONNECTION_REFUSED;
+  std::string body;
+};
+
+extern SimHttpResponse simHttpResponse;
+
+class SimResponseStream : public Stream {
+ public:
+  void rewind() { position = 0; }
+  int available() override { return (int)(simHttpResponse.body.size() - position); }
+  int read() override { return available() > 0 ? (uint8_t)simHttpResponse.body[position++] : -1; }
+  int peek() override { return available() > 0 ? (uint8_t)simHttpResponse.body[position] : -1; }
+  size_t write(uint8_t c) override { return 0; }
+  using Print::write;
+
+ private:
+  size_t position = 0;
+};
+
+class HTTPClient {
+ public:
+  bool begin(WiFiClient& client, const char* url) { return true; }
+  void end() {}
+  void setReuse(bool reuse) {}
+  void setTimeout(uint16_t timeout) {}
+  void setConnectTimeout(int32_t timeout) {}
+  void addHeader(const String& name, const String& value) {}
+
+  int GET() { return respond(); }
+  int POST(uint8_t* payload, size_t size) { return respond(); }
+
+  Stream& getStream() { return response; }
+
+ private:
+  int respond() {
+    response.rewind();
+    return simHttpResponse.code;
+  }
+
+  SimResponseStream response;
+};
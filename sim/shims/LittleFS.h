@@ -0,0 +1,26 @@
+// Host shim: a filesystem that fails to mount, so the offline log stays off
+#pragma once
+
+#include "Arduino.h"
+
+class File : public Stream {
+ public:
+  operator bool() const { return false; }
+  size_t write(uint8_t c) override { return 0; }
+  size_t write(const uint8_t* buffer, size_t size) override { return 0; }
+  using Print::write;
+  size_t read(uint8_t* buffer, size_t size) { return 0; }
+  bool seek(uint32_t position) { return false; }
+  size_t size() { return 0; }
+  void close() {}
+};
+
+class LittleFSFS {
+ public:
+  bool begin(bool formatOnFail = false) { return false; }
+  File open(const char* path, const char* mode) { return File(); }
+  bool exists(const char* path) { return false; }
+  bool remove(const char* path) { return false; }
+};
+
+extern LittleFSFS LittleFS;
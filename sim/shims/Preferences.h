@@ -0,0 +1,14 @@
+// Host shim: NVS that starts empty and keeps nothing past the process
+#pragma once
+
+#include "Arduino.h"
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool readOnly = false) { return true; }
+  size_t getBytes(const char* key, void* buffer, size_t length) { return 0; }
+  size_t putBytes(const char* key, const void* value, size_t length) { return length; }
+  uint8_t getUChar(const char* key, uint8_t defaultValue = 0) { return defaultValue; }
+  size_t putUChar(const char* key, uint8_t value) { return 1; }
+  void end() {}
+};
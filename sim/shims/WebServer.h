@@ -0,0 +1,44 @@
+// Host shim: handlers are registered but only run when a driver calls them.
+// The last response is kept so it can be inspected.
+#pragma once
+
+#include "WiFi.h"
+#include <functional>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+class WebServer {
+ public:
+  explicit WebServer(int port) {}
+
+  void on(const char* uri, std::function<void()> handler) {}
+  void begin() {}
+  void handleClient() {}
+  void collectHeaders(const char* headerKeys[], size_t count) {}
+
+  bool hasArg(const char* name) { return false; }
+  String arg(const char* name) { return String(); }
+  String header(const char* name) { return String(); }
+  WiFiClient client() { return WiFiClient(); }
+
+  void sendHeader(const char* name, const char* value) {}
+  void setContentLength(size_t length) {}
+
+  void send(int code, const char* contentType = nullptr, const char* content = "") {
+    lastCode = code;
+    lastBody = content ? content : "";
+  }
+  void send(int code, const char* contentType, const uint8_t* content, size_t length) {
+    lastCode = code;
+    lastBody.assign((const char*)content, length);
+  }
+  void send_P(int code, const char* contentType, const char* content, size_t length) {
+    lastCode = code;
+    lastBody.assign(content, length);
+  }
+  void sendContent(const char* content, size_t length) { lastBody.append(content, length); }
+  void sendContent(const char* content) { lastBody.append(content); }
+
+  int lastCode = 0;
+  std::string lastBody;
+};
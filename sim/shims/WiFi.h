@@ -0,0 +1,57 @@
+// Host shim: the link is always up and no socket ever connects
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_CONNECTED = 3,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+  ARDUINO_EVENT_WIFI_STA_GOT_IP = 7,
+  ARDUINO_EVENT_MAX = 99
+} WiFiEvent_t;
+
+#define WIFI_STA 1
+
+class WiFiClient : public Stream {
+ public:
+  size_t write(uint8_t c) override { return 0; }
+  using Print::write;
+  bool connected() { return false; }
+  void setNoDelay(bool noDelay) {}
+  void stop() {}
+};
+
+class WiFiClass {
+ public:
+  wl_status_t begin(const char* ssid, const char* password, int32_t channel = 0, const uint8_t* bssid = nullptr,
+                    bool connect = true) {
+    return WL_CONNECTED;
+  }
+  bool mode(int mode) { return true; }
+  bool config(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns = IPAddress()) { return true; }
+  bool disconnect() { return true; }
+  void persistent(bool persistent) {}
+  bool setAutoReconnect(bool autoReconnect) { return true; }
+  wl_status_t status() { return WL_CONNECTED; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+  IPAddress dnsIP() { return IPAddress(127, 0, 0, 1); }
+  uint8_t* BSSID() { return bssid; }
+  int32_t channel() { return 1; }
+  int8_t RSSI() { return -60; }
+  uint8_t* macAddress(uint8_t* mac) {
+    memset(mac, 0, 6);
+    return mac;
+  }
+  void onEvent(void (*handler)(WiFiEvent_t), WiFiEvent_t event = ARDUINO_EVENT_MAX) {}
+
+ private:
+  uint8_t bssid[6] = {};
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,27 @@
+// Host shim: a nominal heap of SIM_HEAP_BYTES that every operator new
+// allocation is charged to. Heap hooks are always on, so allocation counts
+// are gross, as on a core built with CONFIG_HEAP_USE_HOOKS.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONFIG_HEAP_USE_HOOKS 1
+#define MALLOC_CAP_8BIT (1 << 2)
+
+const size_t SIM_HEAP_BYTES = 256 * 1024;
+
+typedef struct {
+  size_t total_free_bytes;
+  size_t total_allocated_bytes;
+  size_t largest_free_block;
+  size_t minimum_free_bytes;
+  size_t allocated_blocks;
+  size_t free_blocks;
+  size_t total_blocks;
+} multi_heap_info_t;
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps);
@@ -0,0 +1,21 @@
+// Host shim: microseconds since boot on the simulation clock. Timers can
+// be created but never fire; a driver calls their callbacks itself.
+#pragma once
+
+#include <stdint.h>
+
+#define ESP_OK 0
+typedef int esp_err_t;
+typedef struct esp_timer* esp_timer_handle_t;
+
+typedef struct {
+  void (*callback)(void* arg);
+  void* arg;
+  int dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time();
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) { return ESP_OK; }
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) { return ESP_OK; }
@@ -0,0 +1,59 @@
+// Host heap accounting behind esp_heap_caps.h
+#include "esp_heap_caps.h"
+#include <malloc.h>
+#include <stdlib.h>
+#include <new>
+
+extern "C" void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) __attribute__((weak));
+extern "C" void esp_heap_trace_free_hook(void* ptr) __attribute__((weak));
+
+static size_t liveBytes = 0;
+static size_t liveBlocks = 0;
+static size_t peakBytes = 0;
+
+static void* allocate(size_t size) {
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  liveBytes += malloc_usable_size(ptr);
+  liveBlocks++;
+  if (liveBytes > peakBytes) peakBytes = liveBytes;
+  if (esp_heap_trace_alloc_hook) esp_heap_trace_alloc_hook(ptr, size, MALLOC_CAP_8BIT);
+  return ptr;
+}
+
+static void release(void* ptr) {
+  if (!ptr) return;
+  liveBytes -= malloc_usable_size(ptr);
+  liveBlocks--;
+  if (esp_heap_trace_free_hook) esp_heap_trace_free_hook(ptr);
+  free(ptr);
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void operator delete(void* ptr) noexcept { release(ptr); }
+void operator delete[](void* ptr) noexcept { release(ptr); }
+void operator delete(void* ptr, size_t size) noexcept { release(ptr); }
+void operator delete[](void* ptr, size_t size) noexcept { release(ptr); }
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  return liveBytes < SIM_HEAP_BYTES ? SIM_HEAP_BYTES - liveBytes : 0;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  return peakBytes < SIM_HEAP_BYTES ? SIM_HEAP_BYTES - peakBytes : 0;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return heap_caps_get_free_size(caps);
+}
+
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps) {
+  info->total_free_bytes = heap_caps_get_free_size(caps);
+  info->total_allocated_bytes = liveBytes;
+  info->largest_free_block = info->total_free_bytes;
+  info->minimum_free_bytes = heap_caps_get_minimum_free_size(caps);
+  info->allocated_blocks = liveBlocks;
+  info->free_blocks = 0;
+  info->total_blocks = liveBlocks;
+}
@@ -0,0 +1,2 @@
+// Host shim: flash and RAM share one address space
+#pragma once
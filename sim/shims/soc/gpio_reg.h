@@ -0,0 +1,11 @@
+// Host shim: the GPIO set/clear registers update the simulated pin levels
+#pragma once
+
+#include <stdint.h>
+
+#define GPIO_OUT_W1TS_REG 0
+#define GPIO_OUT_W1TC_REG 1
+
+void simGpioWrite(int reg, uint32_t bits);
+
+#define REG_WRITE(reg, value) simGpioWrite((reg), (value))
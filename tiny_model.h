@@ -0,0 +1,17 @@
+// Generated by export_tiny_model.py from --prior - do not edit.
+// Untrained: clear sky at half clearness, load held at the last reading
+#pragma once
+
+#include <stdint.h>
+
+constexpr float TINY_LATITUDE = 35.00f;
+constexpr float TINY_SOLAR_NOON = 12.00f;                       // Local standard time hour
+constexpr int TINY_WEIGHT_SHIFT = 10;                           // Weights are Q10
+constexpr uint16_t TINY_PV_NORM = 4000;                         // W with the sun overhead, clear sky
+constexpr int16_t TINY_PV_CLEARNESS = 512;                      // Used without a recent reading
+constexpr int16_t TINY_PV_WEIGHTS[2] = {0, 1024};               // sun, sun * clearness
+constexpr int16_t TINY_PV_BIAS = 0;                             // W
+constexpr uint16_t TINY_LOAD_PROFILE[24] = {500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500};
+constexpr int16_t TINY_LOAD_WEIGHTS[2] = {0, 1024};             // profile, recent load
+constexpr int16_t TINY_LOAD_WEEKEND = 0;                        // W
+constexpr int16_t TINY_LOAD_BIAS = 0;                           // W